@@ -0,0 +1,174 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#include "bakedstyles.h"
+#include "ruleclassifier.h"
+#include "tagpostings.h"
+#include "memoryreport.h"
+#include <wx/filefn.h>
+
+#define BAKEDSTYLES_VERSION "OsmBrowserStylesv1.0\004"
+
+BakedStyles::BakedStyles()
+{
+	m_styles = NULL;
+	m_numWays = m_numRelations = 0;
+}
+
+BakedStyles::~BakedStyles()
+{
+	delete [] m_styles;
+}
+
+void BakedStyles::Clear()
+{
+	delete [] m_styles;
+	m_styles = NULL;
+	m_numWays = m_numRelations = 0;
+}
+
+void BakedStyles::Bake(RuleSet *rules, OsmData *data)
+{
+	Clear();
+
+	m_numWays = data->m_ways.m_objects.GetCount();
+	m_numRelations = data->m_relations.m_objects.GetCount();
+	m_styles = new wxUint16[m_numWays + m_numRelations + 1];
+	m_md5 = rules->MD5();
+
+	RuleClassifier classifier;
+	classifier.Build(rules->GetColorRules(), rules->GetNumColorRules());
+
+	BakeObjects(rules, &classifier, &(data->m_ways.m_objects), m_styles);
+	BakeObjects(rules, &classifier, &(data->m_relations.m_objects), m_styles + m_numWays);
+}
+
+void BakedStyles::BakeObjects(RuleSet *rules, RuleClassifier *classifier, IdObjectArrayLarge *objects, wxUint16 *styles)
+{
+	Rule *drawRule = rules->GetDrawRule();
+	unsigned num = objects->GetCount();
+	IdObjectWithTags const *batch[BAKEBATCHSIZE];
+	IndexBitset hide, unused;
+
+	for (unsigned from = 0; from < num; from += BAKEBATCHSIZE)
+	{
+		unsigned count = num - from < BAKEBATCHSIZE ? num - from : BAKEBATCHSIZE;
+		for (unsigned i = 0; i < count; i++)
+		{
+			batch[i] = static_cast<IdObjectWithTags *>(objects->Get(from + i));
+		}
+
+		// only S_FALSE hides an object, S_IGNORE draws it
+		if (drawRule)
+		{
+			drawRule->EvaluateBatch(batch, count, &unused, &hide);
+		}
+
+		for (unsigned i = 0; i < count; i++)
+		{
+			if (drawRule && hide.Test(i))
+			{
+				styles[from + i] = BAKEDSTYLEHIDDEN;
+				continue;
+			}
+
+			unsigned match = classifier->Classify(batch[i]);
+			styles[from + i] = match < classifier->GetNumRules() ? match : BAKEDSTYLENONE;
+		}
+	}
+}
+
+wxString BakedStyles::GetFileName(wxString const &cacheFile, RuleSet const *rules)
+{
+	return cacheFile + wxT(".") + rules->MD5().ShortHex(16) + wxT(".styles");
+}
+
+bool BakedStyles::Save(wxString const &fileName) const
+{
+	if (!m_styles)
+	{
+		return false;
+	}
+
+	FILE *f = fopen(fileName.mb_str(wxConvUTF8), "wb");
+	if (!f)
+	{
+		return false;
+	}
+
+	wxCharBuffer md5 = m_md5.ShortHex(16).mb_str(wxConvUTF8);
+
+	bool ok = fwrite(BAKEDSTYLES_VERSION, strlen(BAKEDSTYLES_VERSION), 1, f) == 1
+		&& fwrite(md5.data(), 32, 1, f) == 1
+		&& fwrite(&m_numWays, sizeof(m_numWays), 1, f) == 1
+		&& fwrite(&m_numRelations, sizeof(m_numRelations), 1, f) == 1
+		&& fwrite(m_styles, sizeof(wxUint16), m_numWays + m_numRelations, f) == m_numWays + m_numRelations;
+
+	fclose(f);
+
+	if (!ok)
+	{
+		wxRemoveFile(fileName);
+	}
+
+	return ok;
+}
+
+bool BakedStyles::Load(wxString const &fileName, wxString const &cacheFile, RuleSet const *rules, OsmData *data)
+{
+	if (!wxFileExists(fileName))
+	{
+		return false;
+	}
+
+	// the cache was written again since, maybe from other data with as many objects
+	if (wxFileExists(cacheFile) && wxFileModificationTime(fileName) < wxFileModificationTime(cacheFile))
+	{
+		return false;
+	}
+
+	FILE *f = fopen(fileName.mb_str(wxConvUTF8), "rb");
+	if (!f)
+	{
+		return false;
+	}
+
+	size_t len = strlen(BAKEDSTYLES_VERSION);
+	char header[64];
+	char md5[32];
+	unsigned numWays = 0, numRelations = 0;
+	wxCharBuffer expected = rules->MD5().ShortHex(16).mb_str(wxConvUTF8);
+
+	bool ok = fread(header, len, 1, f) == 1 && !strncmp(header, BAKEDSTYLES_VERSION, len)
+		&& fread(md5, 32, 1, f) == 1 && !strncmp(md5, expected.data(), 32)
+		&& fread(&numWays, sizeof(numWays), 1, f) == 1 && numWays == data->m_ways.m_objects.GetCount()
+		&& fread(&numRelations, sizeof(numRelations), 1, f) == 1 && numRelations == data->m_relations.m_objects.GetCount();
+
+	wxUint16 *styles = NULL;
+	if (ok)
+	{
+		styles = new wxUint16[numWays + numRelations + 1];
+		ok = fread(styles, sizeof(wxUint16), numWays + numRelations, f) == numWays + numRelations;
+	}
+
+	fclose(f);
+
+	if (!ok)
+	{
+		delete [] styles;
+		return false;
+	}
+
+	delete [] m_styles;
+	m_styles = styles;
+	m_numWays = numWays;
+	m_numRelations = numRelations;
+	m_md5 = rules->MD5();
+
+	return true;
+}
+
+void BakedStyles::ReportMemory(MemoryReport *report)
+{
+	report->Add(wxT("baked styles"), m_numWays + m_numRelations, sizeof(wxUint16) * (m_numWays + m_numRelations));
+}
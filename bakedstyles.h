@@ -0,0 +1,81 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#ifndef __BAKEDSTYLES_H__
+#define __BAKEDSTYLES_H__
+
+#include "osm.h"
+#include "ruleset.h"
+
+class MemoryReport;
+class RuleClassifier;
+
+// the values BakedStyles stores for an object that isn't drawn with the style of a color rule
+#define BAKEDSTYLENONE 0xFFFE   // drawn, no color rule matches
+#define BAKEDSTYLEHIDDEN 0xFFFD // the draw rule hides it
+
+// how many objects Bake() evaluates the draw rule for at once
+#define BAKEBATCHSIZE 4096
+
+// what one RuleSet does with every way and relation: hide it, or draw it with the style of a color
+// rule or the default one. Bake() evaluates the rules once for all objects, and the result is kept in
+// a file next to the data cache, named after the MD5 of the RuleSet, so drawing with the same rules
+// later, also in another session, only has to look the style up
+class BakedStyles
+{
+	public:
+		BakedStyles();
+		~BakedStyles();
+
+		void Clear();
+
+		// evaluates rules for all ways and relations of data
+		void Bake(RuleSet *rules, OsmData *data);
+
+		// the file the styles of rules are kept in, for the data in cacheFile
+		static wxString GetFileName(wxString const &cacheFile, RuleSet const *rules);
+
+		bool Save(wxString const &fileName) const;
+
+		// false, and nothing changes, if there is no file, it is older than cacheFile, or it holds the
+		// styles of other rules or data
+		bool Load(wxString const &fileName, wxString const &cacheFile, RuleSet const *rules, OsmData *data);
+
+		// true if it holds the styles of rules
+		bool IsFor(RuleSet const *rules) const
+		{
+			return m_styles && !m_md5.Difference(rules->MD5());
+		}
+
+		// the color rule o is drawn with, BAKEDSTYLENONE or BAKEDSTYLEHIDDEN
+		wxUint16 Get(IdObjectWithTags const *o) const
+		{
+			unsigned i = o->m_index;
+			if (o->IsRelation())
+			{
+				assert(i < m_numRelations);
+				i += m_numWays;
+			}
+			else
+			{
+				assert(i < m_numWays);
+			}
+
+			return m_styles[i];
+		}
+
+		void ReportMemory(MemoryReport *report);
+
+	private:
+		BakedStyles(BakedStyles const &other);
+		BakedStyles const &operator=(BakedStyles const &other);
+
+		void BakeObjects(RuleSet *rules, RuleClassifier *classifier, IdObjectArrayLarge *objects, wxUint16 *styles);
+
+		// the ways first, then the relations
+		wxUint16 *m_styles;
+		unsigned m_numWays, m_numRelations;
+		ExpressionMD5 m_md5; // of the RuleSet
+};
+
+#endif
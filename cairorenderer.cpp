@@ -83,7 +83,7 @@ void CairoPdfRenderer::Begin(Renderer::TYPE type, int layer)
 
 void CairoPdfRenderer::AddPoint(double x, double y, double xshift, double yshift)
 {
-	cairo_line_to(m_context, (x - m_offX) * m_scaleX + xshift, m_outputHeight - (y - m_offY) * m_scaleY + yshift);
+	cairo_line_to(m_context, ToOutputX(x) + xshift, ToOutputY(y) + yshift);
 }
 
 void CairoPdfRenderer::End()
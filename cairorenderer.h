@@ -82,7 +82,7 @@ class CairoRenderer
 
 		void AddPoint(double x, double y, double xshift = 0, double yshift = 0)
 		{
-			cairo_line_to(layers[m_curLayer], (x - m_offX) * m_scaleX + xshift, m_outputHeight - (y - m_offY) * m_scaleY + yshift);
+			cairo_line_to(layers[m_curLayer], ToOutputX(x) + xshift, ToOutputY(y) + yshift);
 		}
 
 		void End();
@@ -110,6 +110,17 @@ class CairoRenderer
 			// not implemented
 		}
 
+		void ReportMemory(MemoryReport *report)
+		{
+			size_t bytes = 0;
+			for (int i = 0; i < m_numLayers; i++)
+			{
+				bytes += cairo_image_surface_get_stride(layerBuffers[i]) * cairo_image_surface_get_height(layerBuffers[i]);
+			}
+
+			report->Add(wxT("cairo layer surfaces"), m_numLayers, bytes);
+		}
+
 
 	private:
 		void Setup(wxBitmap *output)
@@ -181,8 +192,8 @@ class PdfJob
 	: public RenderJob
 {
 	public:
-		PdfJob(MainFrame *mainFrame, Renderer *r)
-			: RenderJob(r)
+		PdfJob(MainFrame *mainFrame, Renderer *r, RuleSet *rules)
+			: RenderJob(r, rules)
 		{
 			m_mainFrame = mainFrame;
 		}
@@ -0,0 +1,139 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#ifndef __CLIP_H__
+#define __CLIP_H__
+
+// cohen-sutherland outcodes: where a point lies relative to the rectangle. a point is inside when
+// its code is 0. a segment whose endpoints share a bit lies completely outside
+#define CLIP_LEFT   1
+#define CLIP_RIGHT  2
+#define CLIP_BOTTOM 4
+#define CLIP_TOP    8
+
+// how many points OutCodes() is meant to be fed at a time. small enough to keep the coordinates in
+// registers / l1, large enough for the compiler to vectorize the loop
+#define CLIPBATCHSIZE 32
+
+// axis aligned rectangle with all bounds inclusive, for the segment tests that are on the hot path
+// of index building, culling and drawing
+class ClipRect
+{
+	public:
+		ClipRect(double minX, double minY, double maxX, double maxY)
+		{
+			m_minX = minX;
+			m_minY = minY;
+			m_maxX = maxX;
+			m_maxY = maxY;
+		}
+
+		unsigned OutCode(double x, double y) const
+		{
+			// comparisons instead of branches
+			return (unsigned)(x < m_minX) * CLIP_LEFT | (unsigned)(x > m_maxX) * CLIP_RIGHT |
+				(unsigned)(y < m_minY) * CLIP_BOTTOM | (unsigned)(y > m_maxY) * CLIP_TOP;
+		}
+
+		// the outcodes of num points. the loop has no dependencies between iterations, so the compiler
+		// turns it into simd code
+		void OutCodes(double const *x, double const *y, unsigned char *codes, unsigned num) const
+		{
+			for (unsigned i = 0; i < num; i++)
+			{
+				codes[i] = (unsigned char)OutCode(x[i], y[i]);
+			}
+		}
+
+		// liang-barsky: clips the segment to the rectangle in place. returns false if nothing of it is
+		// left
+		bool ClipSegment(double *x1, double *y1, double *x2, double *y2) const
+		{
+			double dx = *x2 - *x1;
+			double dy = *y2 - *y1;
+			double t0 = 0, t1 = 1;
+
+			if (!ClipEdge(-dx, *x1 - m_minX, &t0, &t1) || !ClipEdge(dx, m_maxX - *x1, &t0, &t1) ||
+				!ClipEdge(-dy, *y1 - m_minY, &t0, &t1) || !ClipEdge(dy, m_maxY - *y1, &t0, &t1))
+			{
+				return false;
+			}
+
+			double sx = *x1, sy = *y1;
+			if (t1 < 1)
+			{
+				*x2 = sx + t1 * dx;
+				*y2 = sy + t1 * dy;
+			}
+			if (t0 > 0)
+			{
+				*x1 = sx + t0 * dx;
+				*y1 = sy + t0 * dy;
+			}
+
+			return true;
+		}
+
+		// the outcodes are the ones of the endpoints, when the caller already has them. only segments that
+		// can't be decided from the codes alone need the liang-barsky test
+		bool SegmentIntersects(double x1, double y1, double x2, double y2, unsigned code1, unsigned code2) const
+		{
+			if (!(code1 && code2))
+			{
+				return true;
+			}
+
+			if (code1 & code2)
+			{
+				return false;
+			}
+
+			return ClipSegment(&x1, &y1, &x2, &y2);
+		}
+
+		bool SegmentIntersects(double x1, double y1, double x2, double y2) const
+		{
+			return SegmentIntersects(x1, y1, x2, y2, OutCode(x1, y1), OutCode(x2, y2));
+		}
+
+		double m_minX, m_minY, m_maxX, m_maxY;
+
+	private:
+		// one edge of liang-barsky: p is the derivative of the distance to the edge along the segment,
+		// q the distance at the start
+		static bool ClipEdge(double p, double q, double *t0, double *t1)
+		{
+			if (p == 0)
+			{
+				return q >= 0;
+			}
+
+			double t = q / p;
+			if (p < 0)
+			{
+				if (t > *t1)
+				{
+					return false;
+				}
+				if (t > *t0)
+				{
+					*t0 = t;
+				}
+			}
+			else
+			{
+				if (t < *t0)
+				{
+					return false;
+				}
+				if (t < *t1)
+				{
+					*t1 = t;
+				}
+			}
+
+			return true;
+		}
+};
+
+#endif
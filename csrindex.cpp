@@ -0,0 +1,106 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#include "csrindex.h"
+#include <string.h>
+#include <stdlib.h>
+
+CSRIndex::CSRIndex()
+{
+	m_offsets = NULL;
+	m_values = NULL;
+	m_numKeys = 0;
+	m_numValues = 0;
+}
+
+CSRIndex::~CSRIndex()
+{
+	Clear();
+}
+
+void CSRIndex::Clear()
+{
+	delete [] m_offsets;
+	delete [] m_values;
+	m_offsets = NULL;
+	m_values = NULL;
+	m_numKeys = 0;
+	m_numValues = 0;
+}
+
+void CSRIndex::Init(unsigned numKeys)
+{
+	Clear();
+
+	m_numKeys = numKeys;
+	m_offsets = new unsigned[m_numKeys + 2];
+	memset(m_offsets, 0, sizeof(unsigned) * (m_numKeys + 2));
+}
+
+void CSRIndex::Allocate()
+{
+	assert(m_offsets);
+
+	unsigned total = 0;
+	for (unsigned k = 0; k < m_numKeys; k++)
+	{
+		unsigned count = m_offsets[k + 2];
+		m_offsets[k + 1] = total;
+		total += count;
+	}
+
+	m_offsets[0] = 0;
+	m_numValues = total;
+	m_values = new unsigned[m_numValues ? m_numValues : 1];
+}
+
+void CSRIndex::SortUnique()
+{
+	unsigned out = 0;
+	unsigned start = 0;
+
+	for (unsigned k = 0; k < m_numKeys; k++)
+	{
+		unsigned end = m_offsets[k + 1];
+		unsigned *list = m_values + start;
+		unsigned count = end - start;
+
+		// lists are short, insertion sort is fine
+		for (unsigned i = 1; i < count; i++)
+		{
+			unsigned v = list[i];
+			unsigned j = i;
+			while (j > 0 && list[j - 1] > v)
+			{
+				list[j] = list[j - 1];
+				j--;
+			}
+			list[j] = v;
+		}
+
+		m_offsets[k] = out;
+		for (unsigned i = 0; i < count; i++)
+		{
+			if (!i || list[i] != list[i - 1])
+			{
+				m_values[out++] = list[i];
+			}
+		}
+
+		start = end;
+	}
+
+	if (m_numKeys)
+	{
+		m_offsets[m_numKeys] = out;
+	}
+
+	if (out != m_numValues)
+	{
+		unsigned *values = new unsigned[out ? out : 1];
+		memcpy(values, m_values, sizeof(unsigned) * out);
+		delete [] m_values;
+		m_values = values;
+		m_numValues = out;
+	}
+}
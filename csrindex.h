@@ -0,0 +1,92 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#ifndef __CSRINDEX_H__
+#define __CSRINDEX_H__
+
+#include <assert.h>
+#include <stdlib.h>
+
+// compressed sparse row index: maps every key in [0, numKeys) to a list of unsigned values,
+// all stored in one contiguous array. it is built in two passes over the same data:
+//   Init(numKeys);
+//   for all (key, value) pairs: Count(key);
+//   Allocate();
+//   for all (key, value) pairs, in the same order: Fill(key, value);
+// after which the lists keep the order in which they were filled.
+// the Atomic variants can be called from several threads at once. the order within a list is then
+// arbitrary, call SortUnique() afterwards to get a deterministic index.
+class CSRIndex
+{
+	public:
+		CSRIndex();
+		~CSRIndex();
+
+		void Init(unsigned numKeys);
+
+		void Count(unsigned key)
+		{
+			assert(key < m_numKeys);
+			m_offsets[key + 2]++;
+		}
+
+		void CountAtomic(unsigned key)
+		{
+			assert(key < m_numKeys);
+			__sync_fetch_and_add(m_offsets + key + 2, 1);
+		}
+
+		void Allocate();
+
+		void Fill(unsigned key, unsigned value)
+		{
+			assert(key < m_numKeys);
+			m_values[m_offsets[key + 1]++] = value;
+		}
+
+		void FillAtomic(unsigned key, unsigned value)
+		{
+			assert(key < m_numKeys);
+			m_values[__sync_fetch_and_add(m_offsets + key + 1, 1)] = value;
+		}
+
+		// sorts every list and removes duplicate values from it
+		void SortUnique();
+
+		void Clear();
+
+		unsigned GetNumKeys() const { return m_numKeys; }
+		unsigned GetNumValues() const { return m_numValues; }
+
+		unsigned GetCount(unsigned key) const
+		{
+			assert(key < m_numKeys);
+			return m_offsets[key + 1] - m_offsets[key];
+		}
+
+		unsigned const *Get(unsigned key) const
+		{
+			assert(key < m_numKeys);
+			return m_values + m_offsets[key];
+		}
+
+		size_t GetMemoryUsage() const
+		{
+			if (!m_offsets)
+			{
+				return 0;
+			}
+
+			return sizeof(unsigned) * (m_numKeys + 2) + sizeof(unsigned) * (m_numValues ? m_numValues : 1);
+		}
+
+	private:
+		// during Count() key k is counted in m_offsets[k + 2]. Allocate() turns that into the start of
+		// k in m_offsets[k + 1], which Fill() uses as a cursor, so afterwards m_offsets[k] is the start of k
+		unsigned *m_offsets;
+		unsigned *m_values;
+		unsigned m_numKeys;
+		unsigned m_numValues;
+};
+
+#endif
@@ -12,11 +12,18 @@
 
 #include "rulecontrol.h"
 #include "info.h"
+#include "osmcanvas.h"
+#include "memoryreport.h"
 
 BEGIN_EVENT_TABLE(MainFrame, wxFrame)
 	EVT_MENU(Menu_Quit,  MainFrame::OnQuit)
 	EVT_MENU(Menu_About, MainFrame::OnAbout)
 	EVT_MENU(Menu_Save_Pdf, MainFrame::OnSavePdf)
+	EVT_MENU(Menu_Memory_Report, MainFrame::OnMemoryReport)
+	EVT_MENU(Menu_Tag_Statistics, MainFrame::OnTagStatistics)
+	EVT_MENU(Menu_Profile_Rules, MainFrame::OnProfileRules)
+	EVT_MENU(Menu_Rule_Profile, MainFrame::OnRuleProfile)
+	EVT_MENU(Menu_Bake_Styles, MainFrame::OnBakeStyles)
 	EVT_CLOSE(MainFrame::OnClose)
 	EVT_SIZE(MainFrame::OnSize)
 END_EVENT_TABLE()
@@ -40,6 +47,11 @@ MainFrame::MainFrame(wxApp *app, const wxString& title, wxString const &fileName
     helpMenu->Append(Menu_About, _T("&About...\tF1"), _T("Show about dialog"));
 
     fileMenu->Append(Menu_Save_Pdf, _T("Save P&df\tAlt-P"), _T("save current view to pdf"));
+    fileMenu->Append(Menu_Memory_Report, _T("&Memory report"), _T("show how much memory the loaded data uses"));
+    fileMenu->Append(Menu_Tag_Statistics, _T("&Tag statistics"), _T("show the most used tags, and how much the draw rule selects"));
+    fileMenu->AppendCheckItem(Menu_Profile_Rules, _T("&Profile rules"), _T("count how often every part of the rules is evaluated, and how long it takes. slows drawing down"));
+    fileMenu->Append(Menu_Rule_Profile, _T("&Rule profile"), _T("show what evaluating every part of the rules cost while profiling"));
+    fileMenu->Append(Menu_Bake_Styles, _T("&Bake styles"), _T("evaluate the current rules once for all objects, and keep the result next to the cache, so drawing with these rules again only looks it up"));
     fileMenu->Append(Menu_Quit, _T("E&xit\tAlt-X"), _T("Quit this program"));
 
     // now append the freshly created menu to the menu bar...
@@ -208,3 +220,82 @@ void MainFrame::OnSavePdf(wxCommandEvent& WXUNUSED(event))
 	m_canvas->SaveView(wxT("out.pdf"), this);
 }
 
+
+wxString MainFrame::MemoryReportText()
+{
+	MemoryReport report;
+	m_canvas->ReportMemory(&report);
+
+	wxString text = report.Format();
+	puts(text.mb_str(wxConvUTF8));
+
+	return text;
+}
+
+void MainFrame::OnMemoryReport(wxCommandEvent& WXUNUSED(event))
+{
+	wxMessageBox(MemoryReportText(), _T("Memory report"), wxOK | wxICON_INFORMATION, this);
+}
+
+wxString MainFrame::RuleProfileText()
+{
+	// the rules are profiled in the RuleSet that was drawn with
+	RuleSet *rules = m_canvas->GetRuleSet();
+	if (!rules)
+	{
+		return wxT("nothing has been drawn yet");
+	}
+
+	wxString profile = rules->DrawRuleProfileText();
+	wxString text = wxT("draw rule\n") + profile;
+	m_drawRule->ShowProfile(profile);
+
+	for (unsigned i = 0; i < rules->GetNumColorRules(); i++)
+	{
+		profile = rules->ColorRuleProfileText(i);
+		text += wxString::Format(wxT("\ncolor rule %d\n"), i) + profile;
+
+		// the controls can have changed since
+		if ((int)i < m_colorRules->m_num)
+		{
+			m_colorRules->m_rules[i]->ShowProfile(profile);
+		}
+	}
+
+	puts(text.mb_str(wxConvUTF8));
+
+	return text;
+}
+
+void MainFrame::OnProfileRules(wxCommandEvent &event)
+{
+	LogicalExpression::s_profiling = event.IsChecked();
+
+	RuleSet *rules = m_canvas->GetRuleSet();
+	if (rules)
+	{
+		rules->ClearProfile();
+	}
+
+	m_canvas->Redraw();
+}
+
+void MainFrame::OnRuleProfile(wxCommandEvent& WXUNUSED(event))
+{
+	wxMessageBox(RuleProfileText(), _T("Rule profile"), wxOK | wxICON_INFORMATION, this);
+}
+
+void MainFrame::OnBakeStyles(wxCommandEvent& WXUNUSED(event))
+{
+	wxBusyCursor busy;
+
+	if (!m_canvas->BakeStyles())
+	{
+		wxMessageBox(_T("the styles could not be saved next to the cache, they are only used until the rules change"), _T("Bake styles"), wxOK | wxICON_WARNING, this);
+	}
+}
+
+void MainFrame::OnTagStatistics(wxCommandEvent& WXUNUSED(event))
+{
+	wxMessageBox(m_canvas->TagStatisticsText(m_drawRule), _T("Tag statistics"), wxOK | wxICON_INFORMATION, this);
+}
@@ -25,6 +25,11 @@ public:
 	void OnQuit(wxCommandEvent& event);
 	void OnAbout(wxCommandEvent& event);
 	void OnSavePdf(wxCommandEvent &event);
+	void OnMemoryReport(wxCommandEvent &event);
+	void OnTagStatistics(wxCommandEvent &event);
+	void OnProfileRules(wxCommandEvent &event);
+	void OnRuleProfile(wxCommandEvent &event);
+	void OnBakeStyles(wxCommandEvent &event);
 	void OnClose(wxCloseEvent &event);
 	void OnSize(wxSizeEvent &event);
 
@@ -38,6 +43,12 @@ public:
 
 	void SetProgress(double progress, wxString const &text = wxEmptyString);
 
+	// collects the memory used by the loaded data, and prints it to stdout
+	wxString MemoryReportText();
+
+	// the profiles of the draw rule and the color rules, also printed to stdout
+	wxString RuleProfileText();
+
 private:
 	wxGauge *m_progress;
 	wxStatusBar *m_statusBar;
@@ -56,7 +67,12 @@ enum
 {
 	Menu_Quit = wxID_EXIT,
 	Menu_About = wxID_ABOUT,
-	Menu_Save_Pdf = wxID_HIGHEST
+	Menu_Save_Pdf = wxID_HIGHEST,
+	Menu_Memory_Report,
+	Menu_Tag_Statistics,
+	Menu_Profile_Rules,
+	Menu_Rule_Profile,
+	Menu_Bake_Styles
 
 };
 
@@ -0,0 +1,258 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#include "geometrypyramid.h"
+#include "workerpool.h"
+#include "memoryreport.h"
+
+// simplifies one level of all ways. run once to count the kept vertices, and once more to fill them in
+class SimplifyJob
+	: public ParallelJob
+{
+	public:
+		SimplifyJob(IdObjectArrayLarge *ways, CSRIndex *previous, CSRIndex *level, double tolerance, unsigned numThreads)
+		{
+			m_ways = ways;
+			m_previous = previous;
+			m_level = level;
+			m_tolerance = tolerance;
+			m_fill = false;
+			m_input = new wxArrayInt[numThreads];
+			m_keep = new wxArrayInt[numThreads];
+			m_stack = new wxArrayInt[numThreads];
+		}
+
+		~SimplifyJob()
+		{
+			delete [] m_input;
+			delete [] m_keep;
+			delete [] m_stack;
+		}
+
+		void SetFill()
+		{
+			m_fill = true;
+		}
+
+		void Run(unsigned thread, unsigned from, unsigned to)
+		{
+			for (unsigned w = from; w < to; w++)
+			{
+				OsmWay *way = static_cast<OsmWay *>(m_ways->Get(w));
+				wxArrayInt &input = m_input[thread];
+
+				input.Empty();
+				if (m_previous)
+				{
+					unsigned count = m_previous->GetCount(w);
+					unsigned const *v = m_previous->Get(w);
+					for (unsigned i = 0; i < count; i++)
+					{
+						input.Add(v[i]);
+					}
+				}
+				else
+				{
+					for (unsigned i = 0; i < way->m_numResolvedNodes; i++)
+					{
+						input.Add(i);
+					}
+				}
+
+				if (TooSmall(way, input))
+				{
+					continue;
+				}
+
+				Simplify(way, input, m_keep[thread], m_stack[thread]);
+
+				wxArrayInt &keep = m_keep[thread];
+				for (unsigned i = 0; i < keep.GetCount(); i++)
+				{
+					if (keep[i])
+					{
+						if (m_fill)
+						{
+							m_level->Fill(w, input[i]);
+						}
+						else
+						{
+							m_level->Count(w);
+						}
+					}
+				}
+			}
+		}
+
+	private:
+		bool TooSmall(OsmWay *way, wxArrayInt const &input)
+		{
+			DRect bb;
+			for (unsigned i = 0; i < input.GetCount(); i++)
+			{
+				OsmNode *n = way->m_resolvedNodes[input[i]];
+				if (n)
+				{
+					bb.Include(n->X(), n->Y());
+				}
+			}
+
+			return bb.IsEmpty() || (bb.m_w < m_tolerance && bb.m_h < m_tolerance);
+		}
+
+		// douglas-peucker over every run of resolved nodes, without recursion
+		void Simplify(OsmWay *way, wxArrayInt const &input, wxArrayInt &keep, wxArrayInt &stack)
+		{
+			unsigned n = input.GetCount();
+			OsmNode **nodes = way->m_resolvedNodes;
+			double tolSq = m_tolerance * m_tolerance;
+
+			keep.Empty();
+			keep.Add(0, n);
+
+			unsigned start = 0;
+			while (start < n)
+			{
+				if (!nodes[input[start]])
+				{
+					keep[start++] = 1;
+					continue;
+				}
+
+				unsigned end = start;
+				while (end + 1 < n && nodes[input[end + 1]])
+				{
+					end++;
+				}
+
+				keep[start] = keep[end] = 1;
+
+				stack.Empty();
+				stack.Add(start);
+				stack.Add(end);
+
+				while (stack.GetCount())
+				{
+					unsigned b = stack.Last();
+					stack.RemoveAt(stack.GetCount() - 1);
+					unsigned a = stack.Last();
+					stack.RemoveAt(stack.GetCount() - 1);
+
+					double ax = nodes[input[a]]->X(), ay = nodes[input[a]]->Y();
+					double dx = nodes[input[b]]->X() - ax, dy = nodes[input[b]]->Y() - ay;
+					double lenSq = dx * dx + dy * dy;
+
+					double maxSq = -1;
+					unsigned found = a;
+					for (unsigned i = a + 1; i < b; i++)
+					{
+						double px = nodes[input[i]]->X() - ax, py = nodes[input[i]]->Y() - ay;
+						double distSq;
+						if (lenSq > 0)
+						{
+							// distance to the segment, not the line, so closed ways work
+							double t = (px * dx + py * dy) / lenSq;
+							t = t < 0 ? 0 : (t > 1 ? 1 : t);
+							distSq = DISTSQUARED(px, py, t * dx, t * dy);
+						}
+						else
+						{
+							distSq = px * px + py * py;
+						}
+
+						if (distSq > maxSq)
+						{
+							maxSq = distSq;
+							found = i;
+						}
+					}
+
+					if (maxSq > tolSq)
+					{
+						keep[found] = 1;
+						stack.Add(a);
+						stack.Add(found);
+						stack.Add(found);
+						stack.Add(b);
+					}
+				}
+
+				start = end + 1;
+			}
+		}
+
+		IdObjectArrayLarge *m_ways;
+		CSRIndex *m_previous;
+		CSRIndex *m_level;
+		double m_tolerance;
+		bool m_fill;
+		wxArrayInt *m_input;
+		wxArrayInt *m_keep;
+		wxArrayInt *m_stack;
+};
+
+GeometryPyramid::GeometryPyramid()
+{
+	m_built = false;
+}
+
+void GeometryPyramid::Build(IdObjectArrayLarge *ways)
+{
+	unsigned num = ways->GetCount();
+	WorkerPool pool(0, 256);
+
+	for (unsigned l = 1; l < PYRAMIDNUMLEVELS; l++)
+	{
+		CSRIndex *level = m_levels + l - 1;
+		SimplifyJob job(ways, l > 1 ? level - 1 : NULL, level, GetTolerance(l), pool.GetNumThreads());
+
+		level->Init(num);
+		pool.Run(&job, num);
+		level->Allocate();
+		job.SetFill();
+		pool.Run(&job, num);
+	}
+
+	m_built = true;
+}
+
+unsigned GeometryPyramid::ChooseLevel(double unitsPerPixel) const
+{
+	if (!m_built)
+	{
+		return 0;
+	}
+
+	unsigned level = 0;
+	while (level + 1 < PYRAMIDNUMLEVELS && GetTolerance(level + 1) <= unitsPerPixel / 2)
+	{
+		level++;
+	}
+
+	return level;
+}
+
+unsigned const *GeometryPyramid::GetVertices(OsmWay const *way, unsigned level, unsigned *count) const
+{
+	if (level && m_built && way->IsWay())
+	{
+		CSRIndex const &l = m_levels[level - 1];
+		unsigned c = l.GetCount(way->m_index);
+		if (c)
+		{
+			*count = c;
+			return l.Get(way->m_index);
+		}
+	}
+
+	*count = way->m_numResolvedNodes;
+	return NULL;
+}
+
+void GeometryPyramid::ReportMemory(MemoryReport *report)
+{
+	for (unsigned l = 1; l < PYRAMIDNUMLEVELS; l++)
+	{
+		report->Add(wxString::Format(wxT("geometry level %u"), l), m_levels[l - 1].GetNumValues(), m_levels[l - 1].GetMemoryUsage());
+	}
+}
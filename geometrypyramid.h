@@ -0,0 +1,63 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#ifndef __GEOMETRYPYRAMID_H__
+#define __GEOMETRYPYRAMID_H__
+
+#include "osm.h"
+
+// level 0 is the full geometry. level l > 0 is simplified with a tolerance of
+// PYRAMIDBASETOLERANCE * 4^(l - 1) projected units
+#define PYRAMIDNUMLEVELS 8
+#define PYRAMIDBASETOLERANCE 256.0
+
+// precomputed, generalized way geometry for zoomed out views. every level stores per way the
+// indices into m_resolvedNodes that survive douglas-peucker simplification at the tolerance of that
+// level. each level is simplified from the previous one, so the kept vertices of a level are a
+// subset of those of the level below. ways whose extent is below the tolerance are dropped from a
+// level. unresolved nodes are always kept, so the renderer still breaks lines there
+class GeometryPyramid
+{
+	public:
+		GeometryPyramid();
+
+		// builds all levels for the ways in the array, in parallel. the ways must all come from the
+		// same IdObjectStore, as their m_index is used as key
+		void Build(IdObjectArrayLarge *ways);
+
+		bool IsBuilt() const
+		{
+			return m_built;
+		}
+
+		static double GetTolerance(unsigned level)
+		{
+			return level ? PYRAMIDBASETOLERANCE * (1 << (2 * (level - 1))) : 0;
+		}
+
+		// the coarsest level whose error stays below half a pixel
+		unsigned ChooseLevel(double unitsPerPixel) const;
+
+		// false if the way is too small to be drawn at this level
+		bool IsVisible(OsmWay const *way, unsigned level) const
+		{
+			if (!level || !m_built || !way->IsWay())
+			{
+				return true;
+			}
+
+			return m_levels[level - 1].GetCount(way->m_index) != 0;
+		}
+
+		// the indices into way->m_resolvedNodes to draw at this level. returns NULL if all nodes
+		// should be drawn, which is the case for level 0, and for ways dropped from the level
+		unsigned const *GetVertices(OsmWay const *way, unsigned level, unsigned *count) const;
+
+		void ReportMemory(MemoryReport *report);
+
+	private:
+		CSRIndex m_levels[PYRAMIDNUMLEVELS - 1];
+		bool m_built;
+};
+
+#endif
@@ -37,7 +37,7 @@ InfoTreeCtrl::InfoTreeCtrl(wxWindow *parent)
 	m_canvas = NULL;
 }
 
-void InfoTreeCtrl::SetInfo(TileWay *ways)
+void InfoTreeCtrl::SetInfo(OsmData *data, WayPointerArray const &ways)
 {
 	if (m_canvas)
 	{
@@ -48,12 +48,13 @@ void InfoTreeCtrl::SetInfo(TileWay *ways)
 
 	wxTreeItemId root = AddRoot(wxT("this node is a member of:"));
 
-	for (TileWay *w = ways; w ; w = static_cast<TileWay *>(w->m_next))
+	for (unsigned w = 0; w < ways.GetCount(); w++)
 	{
-		wxTreeItemId wayId = AddWay(root, w->m_way);
-		for (OsmRelationList *rl = w->m_way->m_relations; rl; rl = (OsmRelationList *)(rl->m_next))
+		wxTreeItemId wayId = AddWay(root, ways[w]);
+		unsigned numRelations = data->GetNumRelationsContainingWay(ways[w]);
+		for (unsigned r = 0; r < numRelations; r++)
 		{
-			AddRelation(wayId, rl->m_relation);
+			AddRelation(wayId, data->GetRelationContainingWay(ways[w], r));
 		}
 	}
 
@@ -17,7 +17,7 @@ class InfoTreeCtrl
 	public:
 		InfoTreeCtrl(wxWindow *parent);
 
-		void SetInfo(TileWay *ways);
+		void SetInfo(OsmData *data, WayPointerArray const &ways);
 
 		void SetCanvas(OsmCanvas *c);
 
@@ -0,0 +1,45 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#include "memoryreport.h"
+
+MemoryReport::MemoryReport()
+{
+}
+
+MemoryReport::~MemoryReport()
+{
+	WX_CLEAR_ARRAY(m_entries);
+}
+
+void MemoryReport::Add(wxString const &name, size_t count, size_t bytes, bool estimated)
+{
+	m_entries.Add(new MemoryReportEntry(name, count, bytes, estimated));
+}
+
+size_t MemoryReport::GetTotal() const
+{
+	size_t total = 0;
+
+	for (unsigned i = 0; i < m_entries.GetCount(); i++)
+	{
+		total += m_entries[i]->m_bytes;
+	}
+
+	return total;
+}
+
+wxString MemoryReport::Format() const
+{
+	wxString ret;
+
+	for (unsigned i = 0; i < m_entries.GetCount(); i++)
+	{
+		MemoryReportEntry *e = m_entries[i];
+		ret += wxString::Format(wxT("%-32s %12lu items %14lu bytes%s\n"), e->m_name.c_str(), (unsigned long)e->m_count, (unsigned long)e->m_bytes, e->m_estimated ? wxT(" (estimated)") : wxT(""));
+	}
+
+	ret += wxString::Format(wxT("%-32s %12s       %14lu bytes (%.1f MB)\n"), wxT("total"), wxT(""), (unsigned long)GetTotal(), GetTotal() / (1024.0 * 1024.0));
+
+	return ret;
+}
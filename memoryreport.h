@@ -0,0 +1,52 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#ifndef __MEMORYREPORT_H__
+#define __MEMORYREPORT_H__
+
+#include <stdlib.h>
+#include <wx/string.h>
+#include <wx/dynarray.h>
+
+class MemoryReportEntry
+{
+	public:
+		MemoryReportEntry(wxString const &name, size_t count, size_t bytes, bool estimated)
+		{
+			m_name = name;
+			m_count = count;
+			m_bytes = bytes;
+			m_estimated = estimated;
+		}
+
+		wxString m_name;
+		size_t m_count;
+		size_t m_bytes;
+		bool m_estimated;
+};
+
+WX_DEFINE_ARRAY_PTR(MemoryReportEntry *, MemoryReportEntryArray);
+
+// collects the memory used by the data structures. the structures report themselves through a
+// ReportMemory(MemoryReport *) method. bytes are payload bytes as requested from the allocator,
+// the allocator's own overhead is not included. structures whose internals are hidden from us
+// (wx hash maps) are estimated, and marked as such
+class MemoryReport
+{
+	public:
+		MemoryReport();
+		~MemoryReport();
+
+		// count is the number of items the bytes are spread over, for information only
+		void Add(wxString const &name, size_t count, size_t bytes, bool estimated = false);
+
+		size_t GetTotal() const;
+
+		// one line per entry plus a total
+		wxString Format() const;
+
+	private:
+		MemoryReportEntryArray m_entries;
+};
+
+#endif
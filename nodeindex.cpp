@@ -0,0 +1,210 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#include "nodeindex.h"
+#include "memoryreport.h"
+
+// ranges this small are searched linearly instead of split further
+#define NODEINDEXLEAFSIZE 8
+
+NodeIndex::NodeIndex()
+{
+	m_data = NULL;
+	m_nodes = NULL;
+	m_numNodes = 0;
+}
+
+NodeIndex::~NodeIndex()
+{
+	delete [] m_nodes;
+}
+
+void NodeIndex::Build(OsmData *data)
+{
+	delete [] m_nodes;
+
+	m_data = data;
+	unsigned num = data->m_nodes.m_objects.GetCount();
+
+	// only the nodes of ways can be selected
+	m_numNodes = 0;
+	for (unsigned n = 0; n < num; n++)
+	{
+		if (data->GetNumWaysContainingNode(GetNode(n)))
+		{
+			m_numNodes++;
+		}
+	}
+
+	m_nodes = new unsigned[m_numNodes ? m_numNodes : 1];
+
+	unsigned e = 0;
+	for (unsigned n = 0; n < num; n++)
+	{
+		if (data->GetNumWaysContainingNode(GetNode(n)))
+		{
+			m_nodes[e++] = n;
+		}
+	}
+
+	Split(0, m_numNodes, 0);
+}
+
+void NodeIndex::Split(unsigned from, unsigned to, unsigned axis)
+{
+	if (to - from <= NODEINDEXLEAFSIZE)
+	{
+		return;
+	}
+
+	unsigned mid = from + (to - from) / 2;
+
+	// quickselect, so that everything before mid is <= mid and everything after it >= mid on this axis
+	int lo = from;
+	int hi = to - 1;
+	while (lo < hi)
+	{
+		wxInt32 pivot = GetCoord(m_nodes[lo + (hi - lo) / 2], axis);
+
+		int i = lo;
+		int j = hi;
+		while (i <= j)
+		{
+			while (GetCoord(m_nodes[i], axis) < pivot)
+			{
+				i++;
+			}
+			while (GetCoord(m_nodes[j], axis) > pivot)
+			{
+				j--;
+			}
+			if (i <= j)
+			{
+				unsigned t = m_nodes[i];
+				m_nodes[i] = m_nodes[j];
+				m_nodes[j] = t;
+				i++;
+				j--;
+			}
+		}
+
+		if ((int)mid <= j)
+		{
+			hi = j;
+		}
+		else if ((int)mid >= i)
+		{
+			lo = i;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	Split(from, mid, axis ^ 1);
+	Split(mid + 1, to, axis ^ 1);
+}
+
+void NodeIndex::Consider(unsigned node, Query *q) const
+{
+	double dx = GetCoord(node, 0) - q->m_x;
+	double dy = GetCoord(node, 1) - q->m_y;
+	double distSq = dx * dx + dy * dy;
+
+	if (q->m_bestDistSq >= 0 && distSq >= q->m_bestDistSq)
+	{
+		return;
+	}
+
+	// the node counts if the filter accepts any of its ways
+	if (q->m_filter)
+	{
+		OsmNode *n = GetNode(node);
+		unsigned numWays = m_data->GetNumWaysContainingNode(n);
+		unsigned i;
+		for (i = 0; i < numWays; i++)
+		{
+			if (q->m_filter->Accept(m_data->GetWayContainingNode(n, i)))
+			{
+				break;
+			}
+		}
+
+		if (i == numWays)
+		{
+			return;
+		}
+	}
+
+	q->m_bestDistSq = distSq;
+	q->m_best = node;
+}
+
+void NodeIndex::Search(unsigned from, unsigned to, unsigned axis, Query *q) const
+{
+	if (to - from <= NODEINDEXLEAFSIZE)
+	{
+		for (unsigned i = from; i < to; i++)
+		{
+			Consider(m_nodes[i], q);
+		}
+
+		return;
+	}
+
+	unsigned mid = from + (to - from) / 2;
+	unsigned node = m_nodes[mid];
+
+	Consider(node, q);
+
+	double d = (axis ? q->m_y : q->m_x) - GetCoord(node, axis);
+
+	// the side the query point is on first, the other one only if the splitting line is closer than
+	// the best so far
+	if (d < 0)
+	{
+		Search(from, mid, axis ^ 1, q);
+		if (q->m_bestDistSq < 0 || d * d < q->m_bestDistSq)
+		{
+			Search(mid + 1, to, axis ^ 1, q);
+		}
+	}
+	else
+	{
+		Search(mid + 1, to, axis ^ 1, q);
+		if (q->m_bestDistSq < 0 || d * d < q->m_bestDistSq)
+		{
+			Search(from, mid, axis ^ 1, q);
+		}
+	}
+}
+
+OsmNode *NodeIndex::GetClosestNode(double x, double y, double maxDist, NodeIndexFilter *filter) const
+{
+	if (!m_numNodes)
+	{
+		return NULL;
+	}
+
+	Query q;
+	q.m_x = x;
+	q.m_y = y;
+	q.m_filter = filter;
+	q.m_bestDistSq = maxDist < 0 ? -1 : maxDist * maxDist;
+	q.m_best = -1;
+
+	Search(0, m_numNodes, 0, &q);
+
+	if (q.m_best < 0)
+	{
+		return NULL;
+	}
+
+	return GetNode(q.m_best);
+}
+
+void NodeIndex::ReportMemory(MemoryReport *report)
+{
+	report->Add(wxT("node search index"), m_numNodes, m_numNodes * sizeof(unsigned));
+}
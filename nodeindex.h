@@ -0,0 +1,71 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#ifndef __NODEINDEX_H__
+#define __NODEINDEX_H__
+
+#include "osm.h"
+
+class MemoryReport;
+
+// decides which ways take part in a NodeIndex query, e.g. only the ones that are drawn
+class NodeIndexFilter
+{
+	public:
+		virtual ~NodeIndexFilter() { }
+
+		virtual bool Accept(OsmWay *way) = 0;
+};
+
+// implicit k-d tree over the nodes of the ways, for nearest node queries. every node that is in a
+// way is in the tree once, by its index, and its coordinates are read from the projected column. a
+// query finds the ways of a node through the node -> way index of the data, to skip the nodes of
+// which the filter rejects all ways. the tree is stored as one array: the median of a range splits
+// it, alternating between x and y with the depth, so there are no child pointers
+class NodeIndex
+{
+	public:
+		NodeIndex();
+		~NodeIndex();
+
+		// after OsmData::Resolve(). the data must stay alive
+		void Build(OsmData *data);
+
+		// the closest node within maxDist of (x, y), in projected coordinates, belonging to a way filter
+		// accepts. maxDist < 0 means any distance, filter NULL means all ways. returns NULL if there
+		// is none
+		OsmNode *GetClosestNode(double x, double y, double maxDist, NodeIndexFilter *filter) const;
+
+		void ReportMemory(MemoryReport *report);
+
+	private:
+		class Query
+		{
+			public:
+				double m_x, m_y;
+				NodeIndexFilter *m_filter;
+				double m_bestDistSq; // < 0 while nothing is found and there is no maximum distance
+				int m_best;          // node index, -1 while nothing is found
+		};
+
+		static wxInt32 GetCoord(unsigned node, unsigned axis)
+		{
+			ProjectedPoint const &p = OsmNode::m_projected[node];
+			return axis ? p.m_y : p.m_x;
+		}
+
+		OsmNode *GetNode(unsigned node) const
+		{
+			return static_cast<OsmNode *>(m_data->m_nodes.m_objects[node]);
+		}
+
+		void Split(unsigned from, unsigned to, unsigned axis);
+		void Search(unsigned from, unsigned to, unsigned axis, Query *q) const;
+		void Consider(unsigned node, Query *q) const;
+
+		OsmData *m_data;
+		unsigned *m_nodes; // node indices, in tree order
+		unsigned m_numNodes;
+};
+
+#endif
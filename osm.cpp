@@ -2,9 +2,13 @@
 // copyright Martijn Versteegh
 // osmbrowser is licenced under the gpl v3
 #include "osm.h"
+#include "workerpool.h"
+#include "memoryreport.h"
+#include "tagpostings.h"
 #include <assert.h> // for lazy memory allocation checking
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 
 //compare fuinction for sorted array
@@ -32,6 +36,8 @@ TagStore::TagStore()
 	m_maxNumValues = m_numValues = NULL;
 	m_values = NULL;
 	m_valueMappers	= NULL;
+	m_numbers = NULL;
+	m_numNumbers = m_maxNumNumbers = NULL;
 
 	GrowKeys(1024);
 	
@@ -74,6 +80,9 @@ void TagStore::GrowKeys(unsigned amount)
 	unsigned *newNumValues =  new unsigned[m_maxNumKeys + amount];
 	unsigned *newMaxNumValues = new unsigned[m_maxNumKeys + amount];
 	StringToIndexMapper **newMappers = new StringToIndexMapper *[m_maxNumKeys + amount];
+	double **newNumbers = new double *[m_maxNumKeys + amount];
+	unsigned *newNumNumbers = new unsigned[m_maxNumKeys + amount];
+	unsigned *newMaxNumNumbers = new unsigned[m_maxNumKeys + amount];
 
 	for (unsigned i = 0; i < m_maxNumKeys; i++)
 	{
@@ -82,6 +91,9 @@ void TagStore::GrowKeys(unsigned amount)
 		newNumValues[i] = m_numValues[i];
 		newMaxNumValues[i] = m_maxNumValues[i];
 		newMappers[i] = m_valueMappers[i];
+		newNumbers[i] = m_numbers[i];
+		newNumNumbers[i] = m_numNumbers[i];
+		newMaxNumNumbers[i] = m_maxNumNumbers[i];
 	}
 
 	for (unsigned i = 0; i < amount; i++)
@@ -91,6 +103,9 @@ void TagStore::GrowKeys(unsigned amount)
 		newMaxNumValues[i + m_maxNumKeys] = 0;
 		newNumValues[i + m_maxNumKeys] = 0;
 		newMappers[i + m_maxNumKeys] = NULL;
+		newNumbers[i + m_maxNumKeys] = NULL;
+		newNumNumbers[i + m_maxNumKeys] = 0;
+		newMaxNumNumbers[i + m_maxNumKeys] = 0;
 	}
 
 
@@ -109,6 +124,15 @@ void TagStore::GrowKeys(unsigned amount)
 	delete [] m_valueMappers;
 	m_valueMappers = newMappers;
 
+	delete [] m_numbers;
+	m_numbers = newNumbers;
+
+	delete [] m_numNumbers;
+	m_numNumbers = newNumNumbers;
+
+	delete [] m_maxNumNumbers;
+	m_maxNumNumbers = newMaxNumNumbers;
+
 	m_maxNumKeys += amount;
 }
 
@@ -148,6 +172,7 @@ TagStore::~TagStore()
 			free(m_values[i][j]);
 		}
 		delete [] m_values[i];
+		delete [] m_numbers[i];
 	}
 	
 	delete [] m_keys;
@@ -155,6 +180,42 @@ TagStore::~TagStore()
 	delete [] m_maxNumValues;
 	delete [] m_numValues;
 	delete [] m_valueMappers;
+	delete [] m_numbers;
+	delete [] m_numNumbers;
+	delete [] m_maxNumNumbers;
+}
+
+double const *TagStore::GetNumbers(unsigned keyIndex)
+{
+	assert(keyIndex < m_numKeys);
+
+	unsigned num = m_numValues[keyIndex];
+
+	if (num > m_maxNumNumbers[keyIndex])
+	{
+		double *n = new double[m_maxNumValues[keyIndex]];
+		if (m_numNumbers[keyIndex])
+		{
+			memcpy(n, m_numbers[keyIndex], m_numNumbers[keyIndex] * sizeof(double));
+		}
+		delete [] m_numbers[keyIndex];
+		m_numbers[keyIndex] = n;
+		m_maxNumNumbers[keyIndex] = m_maxNumValues[keyIndex];
+	}
+
+	// values like "50 mph" or "3;4" count as the number they start with
+	for (unsigned i = m_numNumbers[keyIndex]; i < num; i++)
+	{
+		char const *value = m_values[keyIndex][i];
+		char *end;
+		double d = strtod(value, &end);
+
+		m_numbers[keyIndex][i] = (end == value || isinf(d)) ? NAN : d;
+	}
+
+	m_numNumbers[keyIndex] = num;
+
+	return m_numbers[keyIndex];
 }
 
 TagIndex TagStore::Find(char const *key, char const *value)
@@ -292,7 +353,55 @@ unsigned TagStore::AddValue(unsigned key, char const *value)
 	return m_numValues[key] - 1;
 }
 
+// wx hash maps don't tell how they are laid out. assume one bucket pointer and one node with a next
+// pointer per entry, and a wxString with its refcount header per key
+static size_t EstimateMapperEntry(char const *key)
+{
+	return 2 * sizeof(void *) + sizeof(StringToIndexMapper::value_type) + 3 * sizeof(int) + (strlen(key) + 1) * sizeof(wxChar);
+}
+
+void TagStore::ReportMemory(MemoryReport *report)
+{
+	size_t keyBytes = 0, valueBytes = 0, valueTables = 0, mapperBytes = 0;
+	size_t numValues = 0, numMapped = 0, numNumbers = 0;
+
+	for (unsigned i = 0; i < m_numKeys; i++)
+	{
+		keyBytes += strlen(m_keys[i]) + 1;
+		mapperBytes += EstimateMapperEntry(m_keys[i]);
+		valueTables += m_maxNumValues[i] * sizeof(char *);
+
+		for (unsigned j = 0; j < m_numValues[i]; j++)
+		{
+			valueBytes += strlen(m_values[i][j]) + 1;
+			if (m_valueMappers[i])
+			{
+				mapperBytes += EstimateMapperEntry(m_values[i][j]);
+				numMapped++;
+			}
+		}
+
+		if (m_valueMappers[i])
+		{
+			mapperBytes += sizeof(StringToIndexMapper);
+		}
+
+		numValues += m_numValues[i];
+		numNumbers += m_maxNumNumbers[i];
+	}
+
+	report->Add(wxT("tagstore key strings"), m_numKeys, keyBytes);
+	report->Add(wxT("tagstore value strings"), numValues, valueBytes);
+	report->Add(wxT("tagstore key tables"), m_maxNumKeys, m_maxNumKeys * (2 * sizeof(char *) + 4 * sizeof(unsigned) + sizeof(StringToIndexMapper *) + sizeof(double *)));
+	report->Add(wxT("tagstore value numbers"), numNumbers, numNumbers * sizeof(double));
+	report->Add(wxT("tagstore value tables"), numValues, valueTables);
+	report->Add(wxT("tagstore mappers"), m_numKeys + numMapped, mapperBytes, true);
+}
+
 TagStore *OsmTag::m_tagStore = 0;
+ProjectedPoint *OsmNode::m_projected = 0;
+DRect *OsmWay::m_wayBBs = 0;
+DRect *OsmRelation::m_relationBBs = 0;
 
 TagIndex TagStore::FindOrAdd(char const *key, char const *value)
 {
@@ -379,7 +488,7 @@ bool OsmTag::KeyExists(char const *key)
 }
 
 
-OsmNode *OsmWay::GetClosestNode(double lon, double lat, double *foundDistSquared)
+OsmNode *OsmWay::GetClosestNode(double x, double y, double *foundDistSquared)
 {
 	double found = -1;
 	unsigned foundIndex = 0;
@@ -389,7 +498,7 @@ OsmNode *OsmWay::GetClosestNode(double lon, double lat, double *foundDistSquared
 	{
 		if (m_resolvedNodes[i])
 		{
-			distsq = DISTSQUARED(m_resolvedNodes[i]->Lon(), m_resolvedNodes[i]->Lat(), lon, lat);
+			distsq = DISTSQUARED((double)m_resolvedNodes[i]->X(), (double)m_resolvedNodes[i]->Y(), x, y);
 
 //			printf("%p:  %f %f  %f %f  %f\n", m_resolvedNodes[i], m_resolvedNodes[i]->m_lon, m_resolvedNodes[i]->m_lat, lon, lat, distsq);
 			if (found < 0 || distsq < found)
@@ -448,29 +557,51 @@ void OsmWay::Resolve(IdObjectStore *store)
 bool OsmWay::Intersects(DRect const &rect) const
 {
 	assert(m_numResolvedNodes);
-	OsmNode *prev = NULL;
-	double px = 0, py = 0;
+
+	if (rect.m_w < 0)
+	{
+		return false;
+	}
+
+	ClipRect clip = rect.GetClipRect();
+
+	// gather the coordinates in batches, classify the whole batch at once, and only do the exact test for
+	// segments the outcodes can't decide. the last point of a batch is carried over as the start of the
+	// next one, so no segment is missed
+	double x[CLIPBATCHSIZE + 1], y[CLIPBATCHSIZE + 1];
+	unsigned char codes[CLIPBATCHSIZE + 1];
+	unsigned num = 0;
+
 	for (unsigned i = 0; i < m_numResolvedNodes; i++)
 	{
 		OsmNode *n = m_resolvedNodes[i];
 		if (n)
 		{
-			double x = n->Lon();
-			double y = n->Lat();
-			if (rect.Contains(x, y))
+			x[num] = n->X();
+			y[num] = n->Y();
+			num++;
+		}
+
+		if (num && (num == CLIPBATCHSIZE + 1 || i == m_numResolvedNodes - 1))
+		{
+			clip.OutCodes(x, y, codes, num);
+
+			if (!codes[0])
 			{
 				return true;
 			}
-			if (prev)
+
+			for (unsigned j = 1; j < num; j++)
 			{
-				if (rect.Intersects(px,py,x,y))
+				if (clip.SegmentIntersects(x[j - 1], y[j - 1], x[j], y[j], codes[j - 1], codes[j]))
 				{
 					return true;
 				}
 			}
-			prev = n;
-			px = x;
-			py = y;
+
+			x[0] = x[num - 1];
+			y[0] = y[num - 1];
+			num = 1;
 		}
 	}
 
@@ -480,6 +611,12 @@ bool OsmWay::Intersects(DRect const &rect) const
 
 
 void OsmRelation::Resolve(IdObjectStore *nodeStore, IdObjectStore *wayStore)
+{
+	ResolveRefs(nodeStore, wayStore);
+	AdoptOuterWayTags();
+}
+
+void OsmRelation::ResolveRefs(IdObjectStore *nodeStore, IdObjectStore *wayStore)
 {
 	OsmWay::Resolve(nodeStore);
 
@@ -509,18 +646,16 @@ void OsmRelation::Resolve(IdObjectStore *nodeStore, IdObjectStore *wayStore)
 		{
 			resolvedAll = false;
 		}
-		else
-		{
-			// add ourselves to this way's relations
-			m_resolvedWays[i]->m_relations = new OsmRelationList(this, m_resolvedWays[i]->m_relations);
-		}
 	}
 
 	if (resolvedAll)
 	{
 		m_wayRefs.Clear();
 	}
+}
 
+void OsmRelation::AdoptOuterWayTags()
+{
 	if (!HasTags() || HasTag("type", "multipolygon"))
 	{
 		unsigned outerWay = 0;
@@ -578,6 +713,8 @@ void IdObjectStore::AddObject(IdObject *o)
 		return;
 
 //    o->m_size = m_content ? m_content->m_size + 1 : 1;
+	assert(m_objects.GetCount() <= MAXOBJECTINDEX);
+	o->m_index = m_objects.GetCount();
 	m_objects.Add(o);
 
 	unsigned key = o->m_id & m_mask;
@@ -586,6 +723,13 @@ void IdObjectStore::AddObject(IdObject *o)
 	m_listSizes[key]++;
 }
 
+void IdObjectStore::ReportMemory(MemoryReport *report, wxString const &name)
+{
+	report->Add(name + wxT(" locator"), m_size, m_size * (sizeof(ObjectList *) + sizeof(int)));
+	report->Add(name + wxT(" locator chains"), m_objects.GetCount(), m_objects.GetCount() * sizeof(ObjectList));
+	report->Add(name + wxT(" object table"), m_objects.GetCount(), m_objects.GetMemoryUsage());
+}
+
 IdObject *IdObjectStore::GetObject(unsigned id)
 {
 	unsigned key = id & m_mask;
@@ -612,6 +756,36 @@ OsmData::OsmData()
 	m_parsingState = PARSE_TOPLEVEL;
 	m_elementCount = 0;
 	m_skipAttribs = false;
+	m_projected = NULL;
+	m_wayBBs = m_relationBBs = NULL;
+	m_nodeTags = m_wayTags = m_relationTags = NULL;
+}
+
+OsmData::~OsmData()
+{
+	delete m_nodeTags;
+	delete m_wayTags;
+	delete m_relationTags;
+
+	if (OsmNode::m_projected == m_projected)
+	{
+		OsmNode::m_projected = NULL;
+	}
+
+	delete [] m_projected;
+
+	if (OsmWay::m_wayBBs == m_wayBBs)
+	{
+		OsmWay::m_wayBBs = NULL;
+	}
+
+	if (OsmRelation::m_relationBBs == m_relationBBs)
+	{
+		OsmRelation::m_relationBBs = NULL;
+	}
+
+	delete [] m_wayBBs;
+	delete [] m_relationBBs;
 }
 
 void OsmData::StartNode(unsigned id, double lat, double lon)
@@ -666,8 +840,6 @@ void OsmData::StartWay(unsigned id)
 
 void OsmData::EndWay()
 {
-	static_cast<OsmWay *>(m_ways.m_objects.Last())->Resolve(&m_nodes);
-
 	assert(m_parsingState == PARSE_WAY);
 
 	m_parsingState = PARSE_TOPLEVEL;
@@ -687,7 +859,6 @@ void OsmData::StartRelation(unsigned id)
 
 void OsmData::EndRelation()
 {
-	static_cast<OsmRelation *>(m_relations.m_objects.Last())->Resolve(&m_nodes, &m_ways);
 	assert(m_parsingState == PARSE_RELATION);
 
 	m_parsingState = PARSE_TOPLEVEL;
@@ -767,19 +938,429 @@ void OsmData::AddAttribute(char const *key, char const *value)
 }
 
 
+// fills the projected coordinate column for a range of nodes
+class ProjectNodesJob
+	: public ParallelJob
+{
+	public:
+		ProjectNodesJob(OsmData *data, ProjectedPoint *projected)
+		{
+			m_data = data;
+			m_projected = projected;
+		}
+
+		void Run(unsigned thread, unsigned from, unsigned to)
+		{
+			for (unsigned n = from; n < to; n++)
+			{
+				OsmNode *node = static_cast<OsmNode *>(m_data->m_nodes.m_objects[n]);
+				m_projected[n].m_x = (wxInt32)floor(ProjectLon(node->Lon()) + .5);
+				m_projected[n].m_y = (wxInt32)floor(ProjectLat(node->Lat()) + .5);
+			}
+		}
+
+	private:
+		OsmData *m_data;
+		ProjectedPoint *m_projected;
+};
+
+// fills the bounding box column for a range of ways or relations. the ways have to be done before
+// the relations, whose boxes are built from theirs
+class BoundsJob
+	: public ParallelJob
+{
+	public:
+		BoundsJob(IdObjectArrayLarge *objects, DRect *bbs)
+		{
+			m_objects = objects;
+			m_bbs = bbs;
+		}
+
+		void Run(unsigned thread, unsigned from, unsigned to)
+		{
+			for (unsigned i = from; i < to; i++)
+			{
+				IdObject *o = m_objects->Get(i);
+				if (o->IsRelation())
+				{
+					m_bbs[i] = static_cast<OsmRelation *>(o)->ComputeBB();
+				}
+				else
+				{
+					m_bbs[i] = static_cast<OsmWay *>(o)->ComputeBB();
+				}
+			}
+		}
+
+	private:
+		IdObjectArrayLarge *m_objects;
+		DRect *m_bbs;
+};
+
+// resolves the node refs of a range of ways. in the second and third run it counts and fills the
+// node -> way index. the stores are only read, and every way only touches itself, so no locking
+class ResolveWaysJob
+	: public ParallelJob
+{
+	public:
+		typedef enum
+		{
+			RESOLVE,
+			COUNT,
+			FILL
+		} STAGE;
+
+		ResolveWaysJob(OsmData *data, CSRIndex *nodeWays)
+		{
+			m_data = data;
+			m_nodeWays = nodeWays;
+			m_stage = RESOLVE;
+		}
+
+		void SetStage(STAGE stage)
+		{
+			m_stage = stage;
+		}
+
+		void Run(unsigned thread, unsigned from, unsigned to)
+		{
+			for (unsigned w = from; w < to; w++)
+			{
+				OsmWay *way = static_cast<OsmWay *>(m_data->m_ways.m_objects[w]);
+
+				if (m_stage == RESOLVE)
+				{
+					way->Resolve(&m_data->m_nodes);
+					continue;
+				}
+
+				// closed ways contain their first node twice, SortUnique() takes care of that
+				for (unsigned i = 0; i < way->m_numResolvedNodes; i++)
+				{
+					OsmNode *node = way->m_resolvedNodes[i];
+					if (node)
+					{
+						if (m_stage == COUNT)
+						{
+							m_nodeWays->CountAtomic(node->m_index);
+						}
+						else
+						{
+							m_nodeWays->FillAtomic(node->m_index, w);
+						}
+					}
+				}
+			}
+		}
+
+	private:
+		OsmData *m_data;
+		CSRIndex *m_nodeWays;
+		STAGE m_stage;
+};
+
+// resolves the node and way refs of a range of relations. the way -> relation links are collected
+// as (way index, relation index) pairs in a buffer per thread, and merged afterwards
+class ResolveRelationsJob
+	: public ParallelJob
+{
+	public:
+		ResolveRelationsJob(OsmData *data, unsigned numThreads)
+		{
+			m_data = data;
+			m_links = new wxArrayInt[numThreads];
+		}
+
+		~ResolveRelationsJob()
+		{
+			delete [] m_links;
+		}
+
+		void Run(unsigned thread, unsigned from, unsigned to)
+		{
+			wxArrayInt &links = m_links[thread];
+
+			for (unsigned r = from; r < to; r++)
+			{
+				OsmRelation *rel = static_cast<OsmRelation *>(m_data->m_relations.m_objects[r]);
+				rel->ResolveRefs(&m_data->m_nodes, &m_data->m_ways);
+
+				for (unsigned i = 0; i < rel->m_numResolvedWays; i++)
+				{
+					OsmWay *way = rel->m_resolvedWays[i];
+					if (way)
+					{
+						links.Add(way->m_index);
+						links.Add(r);
+					}
+				}
+			}
+		}
+
+		wxArrayInt const &GetLinks(unsigned thread) const
+		{
+			return m_links[thread];
+		}
+
+	private:
+		OsmData *m_data;
+		wxArrayInt *m_links;
+};
+
 void OsmData::Resolve()
 {
-	for (unsigned w = 0; w < m_ways.m_objects.GetCount(); w++)
+	unsigned numNodes = m_nodes.m_objects.GetCount();
+	unsigned numWays = m_ways.m_objects.GetCount();
+	unsigned numRelations = m_relations.m_objects.GetCount();
+
+	WorkerPool pool;
+
+	delete [] m_projected;
+	m_projected = new ProjectedPoint[numNodes ? numNodes : 1];
+	OsmNode::m_projected = m_projected;
+
+	ProjectNodesJob project(this, m_projected);
+	pool.Run(&project, numNodes);
+
+	ResolveWaysJob ways(this, &m_nodeWays);
+
+	pool.Run(&ways, numWays);
+
+	m_nodeWays.Init(numNodes);
+	ways.SetStage(ResolveWaysJob::COUNT);
+	pool.Run(&ways, numWays);
+	m_nodeWays.Allocate();
+	ways.SetStage(ResolveWaysJob::FILL);
+	pool.Run(&ways, numWays);
+	m_nodeWays.SortUnique();
+
+	// relations are few but can be big, so hand them out in small blocks
+	WorkerPool relationPool(0, 16);
+	ResolveRelationsJob relations(this, relationPool.GetNumThreads());
+
+	relationPool.Run(&relations, numRelations);
+
+	m_wayRelations.Init(numWays);
+
+	for (unsigned t = 0; t < relationPool.GetNumThreads(); t++)
 	{
-		OsmWay *way = dynamic_cast<OsmWay *>(m_ways.m_objects[w]);
-		wxASSERT(way);
-		way->Resolve(&m_nodes);
+		wxArrayInt const &links = relations.GetLinks(t);
+		for (unsigned i = 0; i < links.GetCount(); i += 2)
+		{
+			m_wayRelations.Count(links[i]);
+		}
 	}
-	
-	for (unsigned r = 0; r < m_relations.m_objects.GetCount(); r++)
+
+	m_wayRelations.Allocate();
+
+	for (unsigned t = 0; t < relationPool.GetNumThreads(); t++)
+	{
+		wxArrayInt const &links = relations.GetLinks(t);
+		for (unsigned i = 0; i < links.GetCount(); i += 2)
+		{
+			m_wayRelations.Fill(links[i], links[i + 1]);
+		}
+	}
+
+	m_wayRelations.SortUnique();
+
+	// the relations' boxes read those of their ways, so the way column has to be in place first.
+	// a column that is being refilled isn't used meanwhile
+	OsmWay::m_wayBBs = NULL;
+	OsmRelation::m_relationBBs = NULL;
+	delete [] m_wayBBs;
+	delete [] m_relationBBs;
+
+	m_wayBBs = new DRect[numWays ? numWays : 1];
+	BoundsJob wayBounds(&m_ways.m_objects, m_wayBBs);
+	pool.Run(&wayBounds, numWays);
+	OsmWay::m_wayBBs = m_wayBBs;
+
+	m_relationBBs = new DRect[numRelations ? numRelations : 1];
+	BoundsJob relationBounds(&m_relations.m_objects, m_relationBBs);
+	relationPool.Run(&relationBounds, numRelations);
+	OsmRelation::m_relationBBs = m_relationBBs;
+
+	// this modifies the tags of other ways, and may add to the tag store, so it stays serial
+	for (unsigned r = 0; r < numRelations; r++)
+	{
+		static_cast<OsmRelation *>(m_relations.m_objects[r])->AdoptOuterWayTags();
+	}
+
+	// after the relations adopted their tags, so the postings see the final ones
+	delete m_nodeTags;
+	delete m_wayTags;
+	delete m_relationTags;
+	m_nodeTags = new TagPostings;
+	m_wayTags = new TagPostings;
+	m_relationTags = new TagPostings;
+	m_nodeTags->Build(&m_nodes.m_objects);
+	m_wayTags->Build(&m_ways.m_objects);
+	m_relationTags->Build(&m_relations.m_objects);
+}
+
+wxString OsmData::TagStatistics(unsigned maxKeys)
+{
+	TagStore *store = OsmTag::m_tagStore;
+	unsigned numKeys = store ? store->GetNumKeys() : 0;
+
+	if (!m_wayTags)
+	{
+		return wxEmptyString;
+	}
+
+	// keep the top keys sorted by total count, insertion sort is fine for a short list
+	wxArrayInt top;
+	wxArrayInt topCounts;
+	for (unsigned k = 0; k < numKeys; k++)
+	{
+		TagIndex key = TagIndex::Create(k);
+		int count = m_nodeTags->GetCount(key) + m_wayTags->GetCount(key) + m_relationTags->GetCount(key);
+		unsigned pos = top.GetCount();
+		while (pos > 0 && topCounts[pos - 1] < count)
+		{
+			pos--;
+		}
+
+		if (pos < maxKeys)
+		{
+			top.Insert(k, pos);
+			topCounts.Insert(count, pos);
+			if (top.GetCount() > maxKeys)
+			{
+				top.RemoveAt(maxKeys);
+				topCounts.RemoveAt(maxKeys);
+			}
+		}
+	}
+
+	wxString ret = wxString::Format(wxT("%-24s %10s %10s %10s  %s\n"), wxT("key"), wxT("nodes"), wxT("ways"), wxT("relations"), wxT("most used value"));
+	for (unsigned i = 0; i < top.GetCount(); i++)
+	{
+		unsigned k = top[i];
+		TagIndex key = TagIndex::Create(k);
+
+		unsigned best = 0, bestCount = 0;
+		for (unsigned v = 1; v <= store->GetNumValues(k); v++)
+		{
+			TagIndex value = TagIndex::Create(k, v);
+			unsigned count = m_nodeTags->GetCount(value) + m_wayTags->GetCount(value) + m_relationTags->GetCount(value);
+			if (count > bestCount)
+			{
+				best = v;
+				bestCount = count;
+			}
+		}
+
+		ret += wxString::Format(wxT("%-24s %10u %10u %10u  %s (%u)\n"),
+			wxString(store->GetKey(k), wxConvUTF8).c_str(),
+			m_nodeTags->GetCount(key), m_wayTags->GetCount(key), m_relationTags->GetCount(key),
+			best ? wxString(store->GetValue(k, best - 1), wxConvUTF8).c_str() : wxT(""), bestCount);
+	}
+
+	return ret;
+}
+
+void OsmData::GetWaysContainingNode(OsmNode const *node, WayPointerArray *ways)
+{
+	unsigned count = m_nodeWays.GetCount(node->m_index);
+	unsigned const *w = m_nodeWays.Get(node->m_index);
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		ways->Add(static_cast<OsmWay *>(m_ways.m_objects[w[i]]));
+	}
+}
+
+void OsmData::GetRelationsContainingWay(OsmWay const *way, RelationPointerArray *relations)
+{
+	unsigned count = m_wayRelations.GetCount(way->m_index);
+	unsigned const *r = m_wayRelations.Get(way->m_index);
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		relations->Add(static_cast<OsmRelation *>(m_relations.m_objects[r[i]]));
+	}
+}
+
+static size_t CountTags(IdObjectWithTags *o)
+{
+	size_t ret = 0;
+
+	for (OsmTag *t = o->m_tags; t; t = static_cast<OsmTag *>(t->m_next))
+	{
+		ret++;
+	}
+
+	return ret;
+}
+
+void OsmData::ReportMemory(MemoryReport *report)
+{
+	unsigned numNodes = m_nodes.m_objects.GetCount();
+	unsigned numWays = m_ways.m_objects.GetCount();
+	unsigned numRelations = m_relations.m_objects.GetCount();
+	size_t numTags = 0;
+
+	m_nodes.ReportMemory(report, wxT("nodes"));
+	report->Add(wxT("nodes"), numNodes, numNodes * sizeof(OsmNode));
+	report->Add(wxT("nodes projected"), numNodes, m_projected ? (numNodes ? numNodes : 1) * sizeof(ProjectedPoint) : 0);
+	report->Add(wxT("way bounding boxes"), numWays, m_wayBBs ? (numWays ? numWays : 1) * sizeof(DRect) : 0);
+	report->Add(wxT("relation bounding boxes"), numRelations, m_relationBBs ? (numRelations ? numRelations : 1) * sizeof(DRect) : 0);
+
+	for (unsigned n = 0; n < numNodes; n++)
+	{
+		numTags += CountTags(static_cast<OsmNode *>(m_nodes.m_objects[n]));
+	}
+
+	size_t resolved = 0, refs = 0;
+
+	for (unsigned w = 0; w < numWays; w++)
+	{
+		OsmWay *way = static_cast<OsmWay *>(m_ways.m_objects[w]);
+		numTags += CountTags(way);
+		resolved += way->m_resolvedNodes ? way->m_numResolvedNodes : 0;
+		refs += way->m_nodeRefs.GetCount();
+	}
+
+	m_ways.ReportMemory(report, wxT("ways"));
+	report->Add(wxT("ways"), numWays, numWays * sizeof(OsmWay));
+	report->Add(wxT("ways resolved nodes"), resolved, resolved * sizeof(OsmNode *));
+	report->Add(wxT("ways unresolved refs"), refs, refs * sizeof(unsigned));
+
+	size_t resolvedNodes = 0, resolvedWays = 0, roles = 0;
+	refs = 0;
+
+	for (unsigned r = 0; r < numRelations; r++)
+	{
+		OsmRelation *rel = static_cast<OsmRelation *>(m_relations.m_objects[r]);
+		numTags += CountTags(rel);
+		resolvedNodes += rel->m_resolvedNodes ? rel->m_numResolvedNodes : 0;
+		resolvedWays += rel->m_resolvedWays ? rel->m_numResolvedWays : 0;
+		refs += rel->m_nodeRefs.GetCount() + rel->m_wayRefs.GetCount();
+		roles += rel->m_roles.GetCount();
+	}
+
+	m_relations.ReportMemory(report, wxT("relations"));
+	report->Add(wxT("relations"), numRelations, numRelations * sizeof(OsmRelation));
+	report->Add(wxT("relations resolved members"), resolvedNodes + resolvedWays, resolvedNodes * sizeof(OsmNode *) + resolvedWays * sizeof(OsmWay *));
+	report->Add(wxT("relations unresolved refs"), refs, refs * sizeof(unsigned));
+	report->Add(wxT("relations roles"), roles, roles * sizeof(IdObjectWithRole::ROLE));
+
+	report->Add(wxT("tags"), numTags, numTags * sizeof(OsmTag));
+
+	report->Add(wxT("node -> way index"), m_nodeWays.GetNumValues(), m_nodeWays.GetMemoryUsage());
+	report->Add(wxT("way -> relation index"), m_wayRelations.GetNumValues(), m_wayRelations.GetMemoryUsage());
+
+	if (m_wayTags)
+	{
+		m_nodeTags->ReportMemory(report, wxT("nodes"));
+		m_wayTags->ReportMemory(report, wxT("ways"));
+		m_relationTags->ReportMemory(report, wxT("relations"));
+	}
+
+	if (OsmTag::m_tagStore)
 	{
-		OsmRelation *rel = dynamic_cast<OsmRelation *>(m_relations.m_objects[r]);
-		wxASSERT(rel);
-		rel->Resolve(&m_nodes, &m_ways);
+		OsmTag::m_tagStore->ReportMemory(report);
 	}
 }
@@ -13,8 +13,12 @@
 #include <wx/hashset.h>
 #include <wx/arrstr.h>
 #include <wx/dynarray.h>
-#include "Eigen/Geometry"
+#include "clip.h"
 #include "slabarray.h"
+#include "csrindex.h"
+
+class MemoryReport;
+class TagPostings;
 #define DISTSQUARED(x1, y1, x2, y2)  (((x1) - (x2)) * ((x1) - (x2)) + ((y1) - (y2)) * ((y1) - (y2)))
 
 class DRect
@@ -148,6 +152,11 @@ class DRect
 			return ret;
 		}
 
+		ClipRect GetClipRect() const
+		{
+			return ClipRect(m_x, m_y, m_x + m_w, m_y + m_h);
+		}
+
 		bool Intersects(double x1, double y1, double x2, double y2) const
 		{
 			if (m_w < 0)
@@ -155,69 +164,7 @@ class DRect
 				return false;
 			}
 
-			Eigen::ParametrizedLine<double, 2> line = Eigen::ParametrizedLine<double, 2>::Through(Eigen::Vector2d(x1,y1),Eigen::Vector2d(x2,y2));
-
-			double lensq = (x1-x2) * (x1-x2) + (y1-y2) *(y1-y2);
-
-			Eigen::Hyperplane<double, 2>side = Eigen::Hyperplane<double, 2>::Through(Eigen::Vector2d(m_x,m_y), Eigen::Vector2d(m_x+m_w,m_y));
-
-			double intersect = line.intersection(side);
-
-			if (intersect >=0 && intersect * intersect < lensq)
-			{
-				double x = (line.origin() + intersect * line.direction())[0];
-
-				if (x > m_x && x < m_x + m_w)
-				{
-					return true;
-				}
-			}
-
-
-			side = Eigen::Hyperplane<double, 2>::Through(Eigen::Vector2d(m_x,m_y + m_h), Eigen::Vector2d(m_x+m_w,m_y + m_h));
-
-			intersect = line.intersection(side);
-
-			if (intersect >=0 && intersect * intersect < lensq)
-			{
-				double x = (line.origin() + intersect * line.direction())[0];
-
-				if (x > m_x && x < m_x + m_w)
-				{
-					return true;
-				}
-			}
-
-
-			side = Eigen::Hyperplane<double, 2>::Through(Eigen::Vector2d(m_x,m_y), Eigen::Vector2d(m_x,m_y + m_h));
-
-			intersect = line.intersection(side);
-
-			if (intersect >=0 && intersect * intersect < lensq)
-			{
-				double y = (line.origin() + intersect * line.direction())[1];
-
-				if (y > m_y && y < m_y + m_h)
-				{
-					return true;
-				}
-			}
-
-			side = Eigen::Hyperplane<double, 2>::Through(Eigen::Vector2d(m_x+m_w,m_y), Eigen::Vector2d(m_x+m_w,m_y + m_h));
-
-			intersect = line.intersection(side);
-
-			if (intersect >=0 && intersect * intersect < lensq)
-			{
-				double y = (line.origin() + intersect * line.direction())[1];
-
-				if (y > m_y && y < m_y + m_h)
-				{
-					return true;
-				}
-			}
-
-			return false;
+			return GetClipRect().SegmentIntersects(x1, y1, x2, y2);
 		}
 
 		bool Contains(double x, double y) const
@@ -448,6 +395,13 @@ class TagStore
 	char const *GetKey(TagIndex index);
 	char const *GetValue(TagIndex index);
 
+	// per value of the key, by value number (TagIndex::m_valueIndex - 1), the number the value
+	// starts with, NaN if it doesn't start with one. parsed once, the first time it is asked for
+	// after the value was added
+	double const *GetNumbers(unsigned keyIndex);
+
+	void ReportMemory(MemoryReport *report);
+
 	private:
 	bool FindKey(char const *key, unsigned *k);
 	bool FindValue(unsigned key, char const *value, unsigned *v);
@@ -466,6 +420,12 @@ class TagStore
 
 	StringToIndexMapper **m_valueMappers;
 	StringToIndexMapper m_keyMapper;
+
+	// see GetNumbers(). per key, the numbers of the first m_numNumbers values, room for
+	// m_maxNumNumbers
+	double **m_numbers;
+	unsigned *m_numNumbers;
+	unsigned *m_maxNumNumbers;
 };
 
 class OsmTag
@@ -524,18 +484,40 @@ class OsmTag
 class IdObject
 {
 	public:
+		// what kind of osm element this is. set by the constructors of the derived classes, so type checks
+		// are a plain compare instead of a dynamic_cast
+		enum KIND
+		{
+			OTHER,
+			NODE,
+			WAY,
+			RELATION
+		};
+
 		IdObject(unsigned id = 0)
 		{
 			m_id = id;
+			m_index = 0;
+			m_kind = OTHER;
 		}
 
 		virtual ~IdObject()
 		{
 		}
 
+		bool IsNode() const { return m_kind == NODE; }
+		bool IsWay() const { return m_kind == WAY; }
+		bool IsRelation() const { return m_kind == RELATION; }
+
 		unsigned m_id;
+		// position in the IdObjectStore this object was added to. used as key into the dense per-object indices
+		// the kind shares its word, so objects don't grow
+		unsigned m_index : 30;
+		unsigned m_kind : 2;
 };
 
+#define MAXOBJECTINDEX ((1u << 30) - 1)
+
 int CompareIdObjectPointers(IdObject *o1, IdObject *o2);
 
 WX_DEFINE_ARRAY(IdObject *, IdObjectArraySmall);
@@ -567,25 +549,6 @@ WX_DEFINE_ARRAY(IdObjectWithRole *, IdObjectWithRoleArray);
 WX_DEFINE_ARRAY_CHAR(IdObjectWithRole::ROLE, RolesArray);
 WX_DEFINE_ARRAY_INT(unsigned, IdArray);
 
-WX_DECLARE_HASH_SET(unsigned, wxIntegerHash, wxIntegerEqual, WXIdSet);
-
-class IdSet
-{
-	public:
-		void Add(unsigned id)
-		{
-			m_set.insert(id);
-		}
-
-		bool Has(unsigned id)
-		{
-			return m_set.find(id) != m_set.end();
-		}
-
-	private:
-		WXIdSet m_set;
-};
-
 class IdObjectStore
 {
 	private:
@@ -638,6 +601,9 @@ class IdObjectStore
 
 		void AddObject(IdObject *object);
 		IdObject *GetObject(unsigned id);
+
+		// reports the locator and object table, not the objects themselves
+		void ReportMemory(MemoryReport *report, wxString const &name);
 };
 
 
@@ -693,7 +659,42 @@ class IdObjectWithTags
 
 #define LONLATRESOLUTION 0x7FFFFFFF
 
-class OsmRelationList;
+// rendering and the tile index work in web mercator coordinates, stored in fixed point. the world
+// is the square [-PROJECTIONRESOLUTION, PROJECTIONRESOLUTION] in both directions, y points north
+#define PROJECTIONRESOLUTION 0x3FFFFFFF
+#define MAXMERCATORLAT 85.0511287798
+
+inline double ProjectLon(double lon)
+{
+	return (lon / 180.0) * PROJECTIONRESOLUTION;
+}
+
+inline double ProjectLat(double lat)
+{
+	if (lat > MAXMERCATORLAT)
+		lat = MAXMERCATORLAT;
+	if (lat < -MAXMERCATORLAT)
+		lat = -MAXMERCATORLAT;
+
+	return (log(tan(M_PI / 4 + lat * (M_PI / 360.0))) / M_PI) * PROJECTIONRESOLUTION;
+}
+
+inline double UnprojectX(double x)
+{
+	return (x / PROJECTIONRESOLUTION) * 180.0;
+}
+
+inline double UnprojectY(double y)
+{
+	return atan(sinh((y / PROJECTIONRESOLUTION) * M_PI)) * (180.0 / M_PI);
+}
+
+class ProjectedPoint
+{
+	public:
+		wxInt32 m_x;
+		wxInt32 m_y;
+};
 
 class OsmNode
 	: public IdObjectWithTags
@@ -703,6 +704,8 @@ class OsmNode
 	OsmNode(unsigned id, double lat, double lon)
 		: IdObjectWithTags(id)
 	{
+		m_kind = NODE;
+
 		if (lon > 180.0)
 			lon -= 360.0;
 		if (lon < -180.0)
@@ -727,6 +730,19 @@ class OsmNode
 		 return r;
 	}
 
+	// projected coordinates. they are kept in a separate column, indexed by m_index, which
+	// OsmData::Resolve() fills
+	wxInt32 X() const
+	{
+		return m_projected[m_index].m_x;
+	}
+
+	wxInt32 Y() const
+	{
+		return m_projected[m_index].m_y;
+	}
+
+	static ProjectedPoint *m_projected;
 
 	wxInt32 m_ilat;
 	wxInt32 m_ilon;
@@ -742,9 +758,9 @@ class OsmWay
 	OsmWay(unsigned id)
 		: IdObjectWithTags(id)
 	{
+		m_kind = WAY;
 		m_resolvedNodes = NULL;
 		m_numResolvedNodes = 0;
-		m_relations = NULL;
 	}
 
 	~OsmWay()
@@ -757,25 +773,32 @@ class OsmWay
 		}
 	}
 
+	// projected. kept in a separate column, indexed by m_index, which OsmData::Resolve() fills
 	DRect GetBB()
 	{
-		DRect m_bb;
-		if (m_bb.m_w < 0)
+		return m_wayBBs ? m_wayBBs[m_index] : ComputeBB();
+	}
+
+	// walks the resolved nodes
+	DRect ComputeBB()
+	{
+		DRect bb;
+		for (unsigned i = 0; i < m_numResolvedNodes; i++)
 		{
-			for (unsigned i = 0; i < m_numResolvedNodes; i++)
+			if (m_resolvedNodes[i])
 			{
-				if (m_resolvedNodes[i])
-				{
-					m_bb.Include(m_resolvedNodes[i]->Lon(), m_resolvedNodes[i]->Lat());
-				}
+				bb.Include(m_resolvedNodes[i]->X(), m_resolvedNodes[i]->Y());
 			}
 		}
-		return m_bb;
+		return bb;
 	}
 
+	static DRect *m_wayBBs;
+
 	bool Intersects(DRect const &rect) const;
 
-	OsmNode *GetClosestNode(double lon, double lat, double *foundDistSquared);
+	// in projected coordinates
+	OsmNode *GetClosestNode(double x, double y, double *foundDistSquared);
 
 	unsigned FirstNodeId()
 	{
@@ -842,9 +865,6 @@ class OsmWay
 	OsmNode **m_resolvedNodes;
 	unsigned m_numResolvedNodes;
 //	DRect m_bb;
-
-	// gets filled by OsmRelation::Resolve, so will be empty until the relations are resolved
-	OsmRelationList *m_relations;
 };
 
 
@@ -855,23 +875,33 @@ class OsmRelation
 	OsmRelation(unsigned id)
 		: OsmWay(id)
 	{
+		m_kind = RELATION;
 		m_resolvedWays = NULL;
 		m_numResolvedWays = 0;
 	}
 
 
+	// of the member nodes and ways. like that of a way, kept in a column OsmData::Resolve() fills
 	DRect GetBB()
 	{
-		DRect ret = OsmWay::GetBB();
+		return m_relationBBs ? m_relationBBs[m_index] : ComputeBB();
+	}
+
+	// the ways have to be resolved, their boxes come from their own column
+	DRect ComputeBB()
+	{
+		DRect ret = OsmWay::ComputeBB();
 		for (unsigned i = 0; i < m_numResolvedWays; i++)
 		{
 			if (m_resolvedWays[i])
 			{
-				ret.Add(m_resolvedWays[i]->GetBB());
+				ret = ret.Add(m_resolvedWays[i]->GetBB());
 			}
 		}
 		return ret;
 	}
+
+	static DRect *m_relationBBs;
 	
 	~OsmRelation()
 	{
@@ -893,34 +923,39 @@ class OsmRelation
 	
 	void Resolve(IdObjectStore *nodeStore, IdObjectStore *wayStore);
 
+	// the two halves of Resolve(). ResolveRefs() only touches this relation, so it can run in parallel
+	// for different relations. AdoptOuterWayTags() steals the tags of the outer way of an untagged
+	// multipolygon, and must be run serially after all relations are resolved
+	void ResolveRefs(IdObjectStore *nodeStore, IdObjectStore *wayStore);
+	void AdoptOuterWayTags();
+
 	OsmWay **m_resolvedWays;
 	RolesArray m_roles;
 	unsigned m_numResolvedWays;
 	
 };
 
-
-class OsmRelationList
-	: public ListObject
-{
-	public:
-	OsmRelationList(OsmRelation *r, OsmRelationList *next)
-		: ListObject(next)
-	{
-		m_relation = r;
-	}
-
-	OsmRelation *m_relation;
-};
+WX_DEFINE_ARRAY_PTR(OsmWay *, WayPointerArray);
+WX_DEFINE_ARRAY_PTR(OsmNode *, NodePointerArray);
+WX_DEFINE_ARRAY_PTR(OsmRelation *, RelationPointerArray);
 
 class OsmData
 {
 	public:
 	OsmData();
+	~OsmData();
 
 	IdObjectStore m_nodes;
 	IdObjectStore m_ways;
 	IdObjectStore m_relations;
+
+	// inverted tag indices, per kind of object. built by Resolve()
+	TagPostings *m_nodeTags;
+	TagPostings *m_wayTags;
+	TagPostings *m_relationTags;
+
+	// the most used keys with how many nodes, ways and relations have them, and their most used value
+	wxString TagStatistics(unsigned maxKeys);
 	
 
 	// bounding box;
@@ -953,13 +988,41 @@ class OsmData
 	void Resolve();
 	unsigned m_elementCount;
 
+	void ReportMemory(MemoryReport *report);
+
 	bool m_skipAttribs;
 
-};
+	// reverse lookups, only valid after Resolve()
+	void GetWaysContainingNode(OsmNode const *node, WayPointerArray *ways);
+	void GetRelationsContainingWay(OsmWay const *way, RelationPointerArray *relations);
 
-WX_DEFINE_ARRAY_PTR(OsmWay *, WayPointerArray);
-WX_DEFINE_ARRAY_PTR(OsmNode *, NodePointerArray);
-WX_DEFINE_ARRAY_PTR(OsmRelation *, RelationPointerArray);
+	unsigned GetNumWaysContainingNode(OsmNode const *node)
+	{
+		return m_nodeWays.GetCount(node->m_index);
+	}
+
+	OsmWay *GetWayContainingNode(OsmNode const *node, unsigned i)
+	{
+		return static_cast<OsmWay *>(m_ways.m_objects[m_nodeWays.Get(node->m_index)[i]]);
+	}
+
+	unsigned GetNumRelationsContainingWay(OsmWay const *way)
+	{
+		return m_wayRelations.GetCount(way->m_index);
+	}
+
+	OsmRelation *GetRelationContainingWay(OsmWay const *way, unsigned i)
+	{
+		return static_cast<OsmRelation *>(m_relations.m_objects[m_wayRelations.Get(way->m_index)[i]]);
+	}
+
+	private:
+	ProjectedPoint *m_projected; // node index -> projected coordinates
+	DRect *m_wayBBs;             // way index -> bounding box
+	DRect *m_relationBBs;        // relation index -> bounding box
+	CSRIndex m_nodeWays;      // node index -> indices of the ways containing that node
+	CSRIndex m_wayRelations;  // way index -> indices of the relations containing that way
+};
 
 
 #endif
@@ -7,6 +7,7 @@
 #include "tiledrawer.h"
 #include "info.h"
 #include "frame.h"
+#include "tagpostings.h"
 
 BEGIN_EVENT_TABLE(OsmCanvas, Canvas)
 	EVT_MOUSEWHEEL(OsmCanvas::OnMouseWheel)
@@ -47,6 +48,9 @@ OsmCanvas::OsmCanvas(wxApp * app, MainFrame *mainFrame, wxWindow *parent, wxStri
 		binFile = wxString(wxT("stdin.cache"));
 	}
 
+	// the baked styles are kept next to the cache the data was read from
+	wxString cacheFile = binFile;
+
 	infile = fopen(binFile.mb_str(wxConvUTF8), "r");
 	
 	if (infile)
@@ -79,6 +83,7 @@ OsmCanvas::OsmCanvas(wxApp * app, MainFrame *mainFrame, wxWindow *parent, wxStri
 	
 		if (fileName.EndsWith(wxT(".cache")))
 		{
+			cacheFile = fileName;
 			m_data = parse_binary(infile, true);
 			if (!m_data)
 			{
@@ -104,19 +109,26 @@ OsmCanvas::OsmCanvas(wxApp * app, MainFrame *mainFrame, wxWindow *parent, wxStri
 		fclose(infile);
 	}
 
-	double xscale = 1200.0 / (m_data->m_maxlon - m_data->m_minlon);
-	double yscale = 1200.0 / (m_data->m_maxlon - m_data->m_minlon);
+	// the view works in projected coordinates, which have the same scale in both directions
+	double minX = ProjectLon(m_data->m_minlon);
+	double minY = ProjectLat(m_data->m_minlat);
+	double maxX = ProjectLon(m_data->m_maxlon);
+	double maxY = ProjectLat(m_data->m_maxlat);
+
+	double xscale = 1200.0 / (maxX - minX);
+	double yscale = 1200.0 / (maxY - minY);
 	m_scale = xscale < yscale ? xscale : yscale;
-	m_xOffset = m_data->m_minlon;
-	m_yOffset = m_data->m_minlat;
+	m_xOffset = minX;
+	m_yOffset = minY;
 
 	m_lastX = m_lastY = 0;
 
-	m_tileDrawer = new TileDrawer(m_data->m_minlon, m_data->m_minlat, m_data->m_maxlon, m_data->m_maxlat, .2, .16);
+	m_tileDrawer = new TileDrawer(m_data, minX, minY, maxX, maxY);
 
 	m_tileDrawer->AddWays(&(m_data->m_ways.m_objects));
 
 	m_tileDrawer->SetSelectionColor(255,100,100);
+	m_tileDrawer->SetCacheFile(cacheFile);
 
 	wxWakeUpIdle();
 }
@@ -160,7 +172,7 @@ void OsmCanvas::Render(bool force)
 
 	if (!m_renderJob)
 	{
-		m_renderJob = new CanvasJob(m_app, m_mainFrame, m_renderer);
+		m_renderJob = new CanvasJob(m_app, m_mainFrame, m_renderer, m_tileDrawer->SnapshotRules(m_renderer));
 	}
 
 	m_done = m_tileDrawer->RenderTiles(m_renderJob, 10);
@@ -188,11 +200,10 @@ OsmCanvas::~OsmCanvas()
 
 void OsmCanvas::OnMouseWheel(wxMouseEvent &evt)
 {
-	double scaleCorrection = cos(m_yOffset * M_PI / 180);
 	double w = evt.GetWheelRotation() / 1200.0;
 	int h = m_backBuffer.GetHeight();
 
-	double xm = evt.m_x / (m_scale * scaleCorrection);
+	double xm = evt.m_x / m_scale;
 	double ym = (h - evt.m_y) / m_scale;
 
 	m_xOffset += xm;
@@ -200,7 +211,7 @@ void OsmCanvas::OnMouseWheel(wxMouseEvent &evt)
 
 	m_scale = m_scale * (1.0 + w);
 
-	xm = evt.m_x / (m_scale * scaleCorrection);
+	xm = evt.m_x / m_scale;
 	ym = (h - evt.m_y) / m_scale;
 	m_xOffset -= xm;
 	m_yOffset -= ym;
@@ -211,8 +222,6 @@ void OsmCanvas::OnMouseWheel(wxMouseEvent &evt)
 
 void OsmCanvas::OnMouseMove(wxMouseEvent &evt)
 {
-	double scaleCorrection = cos(m_yOffset * M_PI / 180);
-
 	if (m_dragging)
 	{
 		int idx = evt.m_x - m_lastX;
@@ -223,7 +232,7 @@ void OsmCanvas::OnMouseMove(wxMouseEvent &evt)
 			m_firstDragStep = false;
 			m_lastX = evt.m_x;
 			m_lastY = evt.m_y;
-			double dx = idx / (m_scale * scaleCorrection);
+			double dx = idx / m_scale;
 			double dy = idy / m_scale;
 
 			m_xOffset -= dx;
@@ -237,9 +246,9 @@ void OsmCanvas::OnMouseMove(wxMouseEvent &evt)
 	{
 		if (!m_cursorLocked)
 		{
-			double lon = m_xOffset + evt.m_x / (m_scale * scaleCorrection);
-			double lat = m_yOffset + (m_backBuffer.GetHeight() - evt.m_y) / m_scale;
-			if (m_tileDrawer->SetSelection(lon, lat))
+			double x = m_xOffset + evt.m_x / m_scale;
+			double y = m_yOffset + (m_backBuffer.GetHeight() - evt.m_y) / m_scale;
+			if (m_tileDrawer->SetSelection(x, y, SELECTIONRADIUS / m_scale))
 			{
 				SetupRenderer();
 				m_tileDrawer->DrawOverlay(m_renderer, true);
@@ -248,13 +257,10 @@ void OsmCanvas::OnMouseMove(wxMouseEvent &evt)
 	
 				if (m_info)
 				{
-					TileWay *list = m_tileDrawer->GetSelection();
-	
-	
-					m_info->SetInfo(list);
-	
-					if (list)
-						list->DestroyList();
+					WayPointerArray ways;
+					m_tileDrawer->GetSelection(&ways);
+
+					m_info->SetInfo(m_data, ways);
 				}
 			}
 		}
@@ -289,19 +295,16 @@ void OsmCanvas::OnLeftUp(wxMouseEvent &evt)
 		if (!m_cursorLocked)
 		{
 			m_tileDrawer->SetSelectionColor(255,100,100);
-			double scaleCorrection = cos(m_yOffset * M_PI / 180);
-			double lon = m_xOffset + evt.m_x / (m_scale * scaleCorrection);
-			double lat = m_yOffset + (m_backBuffer.GetHeight() - evt.m_y) / m_scale;
-			if (m_tileDrawer->SetSelection(lon, lat))
+			double x = m_xOffset + evt.m_x / m_scale;
+			double y = m_yOffset + (m_backBuffer.GetHeight() - evt.m_y) / m_scale;
+			if (m_tileDrawer->SetSelection(x, y, SELECTIONRADIUS / m_scale))
 			{
 				if (m_info)
 				{
-					TileWay *list = m_tileDrawer->GetSelection();
-
-					m_info->SetInfo(list);
+					WayPointerArray ways;
+					m_tileDrawer->GetSelection(&ways);
 
-					if (list)
-						list->DestroyList();
+					m_info->SetInfo(m_data, ways);
 				}
 			}
 		}
@@ -333,13 +336,12 @@ void OsmCanvas::SetupRenderer()
 	if (!m_renderer)
 	{
 		m_renderer = new CairoRenderer(&m_backBuffer, NUMLAYERS + 1);
+		m_renderer->SetPyramid(m_tileDrawer->GetPyramid());
 	}
 
-	double scaleCorrection = cos(m_yOffset * M_PI / 180);
-
 	int renderW = m_backBuffer.GetWidth();
 	int renderH = m_backBuffer.GetHeight();
-	double sw = renderW / (scaleCorrection * m_scale);
+	double sw = renderW / m_scale;
 	double sh = renderH / m_scale;
 
 	m_renderer->SetupViewport(DRect(m_xOffset, m_yOffset, sw, sh));
@@ -382,17 +384,19 @@ void OsmCanvas::SaveView(wxString const &fileName, MainFrame *mainFrame)
 	int w = m_backBuffer.GetWidth();
 	int h = m_backBuffer.GetHeight();
 
-	double xScale = cos(m_yOffset * M_PI / 180) * m_scale;
-
 	Renderer *r = new CairoPdfRenderer(fileName, w*10, h*10);
+	r->SetPyramid(m_tileDrawer->GetPyramid());
 
-	r->SetupViewport(DRect(m_xOffset, m_yOffset, w /  xScale, h / m_scale));
+	r->SetupViewport(DRect(m_xOffset, m_yOffset, w / m_scale, h / m_scale));
 
-	PdfJob *job = new PdfJob(mainFrame, r);
+	// at the scale of the pdf, without replacing the rules the canvas draws with
+	PdfJob *job = new PdfJob(mainFrame, r, m_tileDrawer->CreateRules(r));
 
 
 	while(!m_tileDrawer->RenderTiles(job, 100));
 
+	delete job;
+
 //	double progress;
 //!todo
 //	bool done = m_tileDrawer->RenderTiles(m_app, r, m_xOffset, m_yOffset, w / xScale, h / m_scale, true, 10, &progress);
@@ -407,11 +411,64 @@ void OsmCanvas::SaveView(wxString const &fileName, MainFrame *mainFrame)
 	mainFrame->SetProgress(-1);
 
 	delete r;
+
+	// the pdf job has overwritten the render stamps of the canvas job
+	Redraw();
 }
 
 
-CanvasJob::CanvasJob(wxApp *app, MainFrame *mainFrame, Renderer *r)
-	: RenderJob(r)
+void OsmCanvas::ReportMemory(MemoryReport *report)
+{
+	m_data->ReportMemory(report);
+	m_tileDrawer->ReportMemory(report);
+
+	if (m_renderer)
+	{
+		m_renderer->ReportMemory(report);
+	}
+
+	report->Add(wxT("canvas back buffer"), 1, m_backBuffer.GetWidth() * m_backBuffer.GetHeight() * 4, true);
+}
+
+bool OsmCanvas::BakeStyles()
+{
+	RuleSet *rules = m_tileDrawer->GetRuleSet();
+	if (!rules)
+	{
+		return false;
+	}
+
+	bool ret = m_tileDrawer->BakeStyles(rules);
+	Redraw();
+
+	return ret;
+}
+
+wxString OsmCanvas::TagStatisticsText(RuleControl *drawRule)
+{
+	wxString ret = m_data->TagStatistics(TAGSTATISTICSNUMKEYS);
+
+	if (drawRule && m_data->m_wayTags)
+	{
+		ret += wxString::Format(wxT("\ndrawn by the current rule: %u of %u ways, %u of %u relations\n"),
+			drawRule->CountMatching(*m_data->m_wayTags, IdObject::WAY), m_data->m_wayTags->GetNumObjects(),
+			drawRule->CountMatching(*m_data->m_relationTags, IdObject::RELATION), m_data->m_relationTags->GetNumObjects());
+	}
+
+	// the tiles that are skipped without looking at their ways
+	RuleSet *rules = m_tileDrawer->GetRuleSet();
+	if (rules)
+	{
+		unsigned numTiles;
+		unsigned skipped = m_tileDrawer->CountSkippedTiles(rules, &numTiles);
+		ret += wxString::Format(wxT("skipped by their tag summary: %u of %u tiles\n"), skipped, numTiles);
+	}
+
+	return ret;
+}
+
+CanvasJob::CanvasJob(wxApp *app, MainFrame *mainFrame, Renderer *r, RuleSet *rules)
+	: RenderJob(r, rules)
 {
 	m_app = app;
 	m_mainFrame = mainFrame;
@@ -12,6 +12,12 @@
 #include "cairorenderer.h"
 #include "tiledrawer.h"
 
+// how far from the mouse, in pixels, a node can be to get selected
+#define SELECTIONRADIUS 24
+
+// how many keys the tag statistics list
+#define TAGSTATISTICSNUMKEYS 40
+
 class RuleControl;
 class ColorRules;
 class InfoTreeCtrl;
@@ -21,7 +27,7 @@ class CanvasJob
 	: public RenderJob
 {
 	public:
-		CanvasJob(wxApp *app, MainFrame *mainFrame, Renderer *r);
+		CanvasJob(wxApp *app, MainFrame *mainFrame, Renderer *r, RuleSet *rules);
 
 		bool MustCancel(double progress);
 
@@ -60,12 +66,27 @@ class OsmCanvas
 
 		void SetRuleControls(RuleControl *rules, ColorRules *colors);
 
+		// the rules drawn with last, NULL if nothing has been drawn yet
+		RuleSet *GetRuleSet()
+		{
+			return m_tileDrawer->GetRuleSet();
+		}
+
+		// bakes the styles of the rules drawn with last, see TileDrawer::BakeStyles(). false if
+		// nothing was drawn yet, or they couldn't be saved
+		bool BakeStyles();
+
 		void SetInfoDisplay(InfoTreeCtrl *info);
 
 		void SaveView(wxString const &fileName, MainFrame *mainFrame);
 
 		void SelectWay(OsmWay *way);
 		void SelectRelation(OsmRelation *rel);
+
+		void ReportMemory(MemoryReport *report);
+
+		// the most used tags, and how many ways and relations drawRule lets through
+		wxString TagStatisticsText(RuleControl *drawRule);
 	private:
 		CanvasJob *m_renderJob;
 		void SetupRenderer();
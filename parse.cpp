@@ -429,8 +429,8 @@ void write_binary(OsmData *d, FILE *f)
 	printf("writing nodes...\n" );
 	for (unsigned n = 0; n < d->m_nodes.m_objects.GetCount(); n++)
 	{
-		OsmNode *node = dynamic_cast<OsmNode *>(d->m_nodes.m_objects[n]);
-		wxASSERT(node);
+		OsmNode *node = static_cast<OsmNode *>(d->m_nodes.m_objects[n]);
+		wxASSERT(node->IsNode());
 		fputc('N', f);
 		double lat = node->Lat();
 		double lon = node->Lon();
@@ -444,8 +444,8 @@ void write_binary(OsmData *d, FILE *f)
 	printf("writing ways...\n" );
 	for (unsigned w = 0; w < d->m_ways.m_objects.GetCount(); w++)
 	{
-		OsmWay *way = dynamic_cast<OsmWay *>(d->m_ways.m_objects[w]);
-		wxASSERT(way);
+		OsmWay *way = static_cast<OsmWay *>(d->m_ways.m_objects[w]);
+		wxASSERT(way->IsWay());
 		fputc('W', f);
 		fwrite(&(way->m_id), sizeof(way->m_id), 1, f);
 
@@ -483,8 +483,8 @@ void write_binary(OsmData *d, FILE *f)
 	printf("writing relations...\n" );
 	for (unsigned r = 0; r < d->m_relations.m_objects.GetCount(); r++)
 	{
-		OsmRelation *rel = dynamic_cast<OsmRelation *>(d->m_relations.m_objects[r]);
-		wxASSERT(rel);
+		OsmRelation *rel = static_cast<OsmRelation *>(d->m_relations.m_objects[r]);
+		wxASSERT(rel->IsRelation());
 		fputc('R', f);
 		fwrite(&(rel->m_id), sizeof(rel->m_id), 1, f);
 
@@ -18,7 +18,7 @@ void SimplePolygon::AddWayPoints(OsmWay *w, bool reverse, Renderer::POINTADDMODE
 
 		if (node)
 		{
-			AddPoint(node->Lon(), node->Lat());
+			AddPoint(node->X(), node->Y());
 			count++;
 		}
 		//! maybe warn if we encounter any unresolved nodes here? for now we just accept any drawing errors
@@ -26,7 +26,7 @@ void SimplePolygon::AddWayPoints(OsmWay *w, bool reverse, Renderer::POINTADDMODE
 
 	if (mode == Renderer::REPEATFIRST && first)
 	{
-		AddPoint(first->Lon(), first->Lat());
+		AddPoint(first->X(), first->Y());
 	}
 
 }
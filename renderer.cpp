@@ -92,16 +92,67 @@ void RendererWxBitmap::Commit()
 
 }
 
+bool Renderer::IsOutsideView(OsmWay const *w) const
+{
+	unsigned numVertices = 0;
+	unsigned const *vertices = GetWayVertices(w, &numVertices);
+
+	double x[CLIPBATCHSIZE], y[CLIPBATCHSIZE];
+	unsigned char codes[CLIPBATCHSIZE];
+	unsigned num = 0;
+	unsigned common = CLIP_LEFT | CLIP_RIGHT | CLIP_BOTTOM | CLIP_TOP;
+
+	for (unsigned j = 0; j < numVertices; j++)
+	{
+		OsmNode *node = w->m_resolvedNodes[vertices ? vertices[j] : j];
+		if (node)
+		{
+			x[num] = node->X();
+			y[num] = node->Y();
+			num++;
+		}
+
+		if (num && (num == CLIPBATCHSIZE || j == numVertices - 1))
+		{
+			m_clipRect.OutCodes(x, y, codes, num);
+			for (unsigned k = 0; k < num; k++)
+			{
+				common &= codes[k];
+			}
+
+			if (!common)
+			{
+				return false;
+			}
+
+			num = 0;
+		}
+	}
+
+	return true;
+}
+
 void Renderer::AddWayPoints(OsmWay *w, bool reverse, POINTADDMODE mode)
 {
 
+	unsigned numVertices = 0;
+	unsigned const *vertices = GetWayVertices(w, &numVertices);
+
 	int start = mode == SKIPFIRST ? 1 : 0;
-	unsigned maxCount = mode == ONLYFIRST ? 1 : w->m_numResolvedNodes;
+	unsigned maxCount = mode == ONLYFIRST ? 1 : numVertices;
 	OsmNode *first = NULL;
-	for (unsigned j = start, count = 0; j < w->m_numResolvedNodes && count < maxCount; j++)
+
+	// a run of points that are all outside the view on the same side is replaced by the first and last
+	// of them. the part of the outline that gets dropped, and the chord replacing it, both lie in that
+	// outside half plane, so nothing changes inside the view, for lines nor for fills
+	OsmNode *pending = NULL; // the last point of the current run, not added yet
+	unsigned pendingCode = 0;
+	unsigned runCode = 0; // the sides the last added point and the run after it all are on
+
+	for (unsigned j = start, count = 0; j < numVertices && count < maxCount; j++)
 	{
-		int index = reverse ? w->m_numResolvedNodes - 1 - j : j;
-		OsmNode *node = w->m_resolvedNodes[index];
+		int index = reverse ? numVertices - 1 - j : j;
+		OsmNode *node = w->m_resolvedNodes[vertices ? vertices[index] : index];
 
 		if (!first)
 		{
@@ -110,14 +161,40 @@ void Renderer::AddWayPoints(OsmWay *w, bool reverse, POINTADDMODE mode)
 
 		if (node)
 		{
-			AddPoint(node->Lon(), node->Lat());
+			double x = node->X();
+			double y = node->Y();
+			unsigned code = m_clipRect.OutCode(x, y);
+
+			if (pending && !(runCode & code))
+			{
+				AddPoint(pending->X(), pending->Y());
+				runCode = pendingCode;
+				pending = NULL;
+			}
+
+			if (runCode & code)
+			{
+				pending = node;
+				pendingCode = code;
+				runCode &= code;
+			}
+			else
+			{
+				AddPoint(x, y);
+				runCode = code;
+			}
 			count++;
 		}
 		//! maybe warn if we encounter any unresolved nodes here? for now we just accept any drawing errors
 	}
 
+	if (pending)
+	{
+		AddPoint(pending->X(), pending->Y());
+	}
+
 	if (mode == REPEATFIRST && first)
 	{
-		AddPoint(first->Lon(), first->Lat());
+		AddPoint(first->X(), first->Y());
 	}
 }
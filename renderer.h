@@ -5,14 +5,23 @@
 #define __RENDERER_H__
 
 #include "osm.h"
+#include "memoryreport.h"
+#include "geometrypyramid.h"
 #include <wx/dcmemory.h>
 
+// how far outside the output, in pixels, geometry still counts as visible. keeps thick lines that run
+// just outside the border intact
+#define RENDERCLIPMARGIN 16
+
 class Renderer
 {
 	public:
 		Renderer(int numLayers)
+			: m_clipRect(0, 0, 0, 0)
 		{
 			m_numLayers = numLayers;
+			m_pyramid = NULL;
+			m_geometryLevel = 0;
 		}
 		virtual ~Renderer() { }
 
@@ -71,13 +80,71 @@ class Renderer
 		// merge all layers and output to screen
 		virtual void Commit() = 0;
 
+		// reports the buffers the renderer keeps
+		virtual void ReportMemory(MemoryReport *report) { }
+
+		// the viewport is in projected coordinates
 		virtual void SetupViewport(DRect const &viewport)
 		{
 			  m_offX = viewport.m_x;
 			  m_offY = viewport.m_y;
 			  m_scaleX = m_outputWidth / viewport.m_w;
 			  m_scaleY = m_outputHeight/ viewport.m_h;
-			  
+
+			  // so the transform to output coordinates is a single multiply-add per axis
+			  m_biasX = -m_offX * m_scaleX;
+			  m_biasY = m_outputHeight + m_offY * m_scaleY;
+			  m_flipScaleY = -m_scaleY;
+
+			  double marginX = RENDERCLIPMARGIN / m_scaleX;
+			  double marginY = RENDERCLIPMARGIN / m_scaleY;
+			  m_clipRect = ClipRect(viewport.m_x - marginX, viewport.m_y - marginY, viewport.Right() + marginX, viewport.Top() + marginY);
+
+			  m_geometryLevel = m_pyramid ? m_pyramid->ChooseLevel(1.0 / m_scaleX) : 0;
+		}
+
+		// use generalized geometry from the pyramid, at the level that fits the viewport. call before
+		// SetupViewport()
+		void SetPyramid(GeometryPyramid const *pyramid)
+		{
+			m_pyramid = pyramid;
+		}
+
+		unsigned GetGeometryLevel() const
+		{
+			return m_geometryLevel;
+		}
+
+		// false if the way is too small to see at the current scale
+		bool IsVisible(OsmWay const *w) const
+		{
+			return !m_pyramid || m_pyramid->IsVisible(w, m_geometryLevel);
+		}
+
+		// true if all of the way, at the current geometry level, lies outside the viewport on one side, so
+		// neither its outline nor its fill can show up
+		bool IsOutsideView(OsmWay const *w) const;
+
+		// the indices into w->m_resolvedNodes to draw at the current scale, NULL means all of them
+		unsigned const *GetWayVertices(OsmWay const *w, unsigned *count) const
+		{
+			if (!m_pyramid)
+			{
+				*count = w->m_numResolvedNodes;
+				return NULL;
+			}
+
+			return m_pyramid->GetVertices(w, m_geometryLevel, count);
+		}
+
+		double ToOutputX(double x) const
+		{
+			return x * m_scaleX + m_biasX;
+		}
+
+		double ToOutputY(double y) const
+		{
+			return y * m_flipScaleY + m_biasY;
 		}
 
 		DRect GetViewport()
@@ -97,9 +164,13 @@ class Renderer
 		void AddWayPoints(OsmWay *w, bool reverse, POINTADDMODE mode); // skipFirst will skip first *drawn* . when reverse==true this is the last in the Way
 
 	protected:
+		ClipRect m_clipRect; // the viewport plus the margin, in projected coordinates
 		double m_offX, m_offY, m_scaleX, m_scaleY;
+		double m_biasX, m_biasY, m_flipScaleY;
 		double m_outputWidth, m_outputHeight;
 		int m_numLayers;
+		GeometryPyramid const *m_pyramid;
+		unsigned m_geometryLevel;
 };
 
 class RendererSimple
@@ -296,8 +367,8 @@ class RendererWxBitmap
 		
 			for (unsigned i = 0; i < m_numPoints; i++)
 			{
-				m_wxPoints[i].x = static_cast<int>((m_points[i].x - m_offX) * m_scaleX + m_shifts[i].x);
-				m_wxPoints[i].y = m_layer[0].GetHeight() - static_cast<int>((m_points[i].y - m_offY) * m_scaleY + m_shifts[i].y);
+				m_wxPoints[i].x = static_cast<int>(ToOutputX(m_points[i].x) + m_shifts[i].x);
+				m_wxPoints[i].y = static_cast<int>(ToOutputY(m_points[i].y) - m_shifts[i].y);
 			}
 		}
 		void BlitWithTransparency(wxBitmap *from, wxImage  *to);
@@ -0,0 +1,148 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#include "rulecache.h"
+#include "memoryreport.h"
+
+RuleResults::RuleResults(ExpressionMD5 const &md5, unsigned numWays, unsigned numRelations)
+{
+	m_md5 = md5;
+	m_numWays = numWays;
+	m_numRelations = numRelations;
+	m_lastRound = 0;
+
+	m_ways = new wxUint64[GetNumWords(numWays) ? GetNumWords(numWays) : 1];
+	m_relations = new wxUint64[GetNumWords(numRelations) ? GetNumWords(numRelations) : 1];
+	memset(m_ways, 0, sizeof(wxUint64) * GetNumWords(numWays));
+	memset(m_relations, 0, sizeof(wxUint64) * GetNumWords(numRelations));
+}
+
+RuleResults::~RuleResults()
+{
+	delete [] m_ways;
+	delete [] m_relations;
+}
+
+RuleCache::RuleCache()
+{
+	m_numWays = 0;
+	m_numRelations = 0;
+	m_round = 1;
+}
+
+RuleCache::~RuleCache()
+{
+	Clear();
+}
+
+void RuleCache::Clear()
+{
+	WX_CLEAR_ARRAY(m_results);
+}
+
+void RuleCache::Init(unsigned numWays, unsigned numRelations)
+{
+	Clear();
+	m_numWays = numWays;
+	m_numRelations = numRelations;
+}
+
+RuleResults *RuleCache::Get(ExpressionMD5 const &md5)
+{
+	for (unsigned i = 0; i < m_results.GetCount(); i++)
+	{
+		if (!m_results[i]->m_md5.Difference(md5))
+		{
+			m_results[i]->m_lastRound = m_round;
+			return m_results[i];
+		}
+	}
+
+	// make room by dropping the least recently used results, as long as they aren't used this round
+	if (m_results.GetCount() >= RULECACHEMAXENTRIES)
+	{
+		int oldest = -1;
+		for (unsigned i = 0; i < m_results.GetCount(); i++)
+		{
+			if (m_results[i]->m_lastRound != m_round && (oldest < 0 || m_results[i]->m_lastRound < m_results[oldest]->m_lastRound))
+			{
+				oldest = i;
+			}
+		}
+
+		if (oldest >= 0)
+		{
+			delete m_results[oldest];
+			m_results.RemoveAt(oldest);
+		}
+	}
+
+	RuleResults *ret = new RuleResults(md5, m_numWays, m_numRelations);
+	ret->m_lastRound = m_round;
+	m_results.Add(ret);
+
+	return ret;
+}
+
+StyleCache::StyleCache()
+{
+	m_ways = NULL;
+	m_relations = NULL;
+	m_numWays = 0;
+	m_numRelations = 0;
+}
+
+StyleCache::~StyleCache()
+{
+	delete [] m_ways;
+	delete [] m_relations;
+}
+
+void StyleCache::Init(unsigned numWays, unsigned numRelations)
+{
+	delete [] m_ways;
+	delete [] m_relations;
+
+	m_numWays = numWays;
+	m_numRelations = numRelations;
+	m_ways = new wxUint16[numWays ? numWays : 1];
+	m_relations = new wxUint16[numRelations ? numRelations : 1];
+	memset(m_ways, 0xFF, sizeof(wxUint16) * numWays);
+	memset(m_relations, 0xFF, sizeof(wxUint16) * numRelations);
+}
+
+void StyleCache::Invalidate(unsigned first)
+{
+	// STYLECACHENONE and STYLECACHEUNKNOWN are above every rule index
+	for (unsigned i = 0; i < m_numWays; i++)
+	{
+		if (m_ways[i] >= first)
+		{
+			m_ways[i] = STYLECACHEUNKNOWN;
+		}
+	}
+
+	for (unsigned i = 0; i < m_numRelations; i++)
+	{
+		if (m_relations[i] >= first)
+		{
+			m_relations[i] = STYLECACHEUNKNOWN;
+		}
+	}
+}
+
+void StyleCache::ReportMemory(MemoryReport *report)
+{
+	report->Add(wxT("style cache"), m_numWays + m_numRelations, sizeof(wxUint16) * (m_numWays + m_numRelations));
+}
+
+void RuleCache::ReportMemory(MemoryReport *report)
+{
+	size_t bytes = 0;
+	for (unsigned i = 0; i < m_results.GetCount(); i++)
+	{
+		bytes += m_results[i]->GetMemoryUsage();
+	}
+
+	report->Add(wxT("rule result cache"), m_results.GetCount(), bytes);
+}
@@ -0,0 +1,204 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#ifndef __RULECACHE_H__
+#define __RULECACHE_H__
+
+#include "s_expr.h"
+
+class MemoryReport;
+
+// how many RuleResults a RuleCache keeps before it drops ones that aren't in use
+#define RULECACHEMAXENTRIES 64
+
+// the values one rule gave for the ways and relations, filled in as they are evaluated. two bits per
+// object: 0 if it hasn't been evaluated yet, otherwise the LogicalExpression::STATE + 1. nodes
+// aren't kept
+class RuleResults
+{
+	public:
+		RuleResults(ExpressionMD5 const &md5, unsigned numWays, unsigned numRelations);
+		~RuleResults();
+
+		// false if o hasn't been evaluated yet
+		bool Get(IdObjectWithTags const *o, LogicalExpression::STATE *state) const
+		{
+			unsigned num;
+			wxUint64 const *bits = GetBits(o, &num);
+
+			if (!bits || o->m_index >= num)
+			{
+				return false;
+			}
+
+			unsigned v = (bits[o->m_index >> 5] >> ((o->m_index & 31) * 2)) & 3;
+			if (!v)
+			{
+				return false;
+			}
+
+			*state = static_cast<LogicalExpression::STATE>(v - 1);
+			return true;
+		}
+
+		void Set(IdObjectWithTags const *o, LogicalExpression::STATE state)
+		{
+			unsigned num;
+			wxUint64 *bits = GetBits(o, &num);
+
+			if (bits && o->m_index < num)
+			{
+				bits[o->m_index >> 5] |= (wxUint64)(state + 1) << ((o->m_index & 31) * 2);
+			}
+		}
+
+		ExpressionMD5 const &MD5() const
+		{
+			return m_md5;
+		}
+
+		size_t GetMemoryUsage() const
+		{
+			return sizeof(wxUint64) * (GetNumWords(m_numWays) + GetNumWords(m_numRelations));
+		}
+
+	private:
+		friend class RuleCache;
+
+		static unsigned GetNumWords(unsigned num)
+		{
+			return (num + 31) >> 5;
+		}
+
+		wxUint64 *GetBits(IdObjectWithTags const *o, unsigned *num) const
+		{
+			if (o->IsWay())
+			{
+				*num = m_numWays;
+				return m_ways;
+			}
+			else if (o->IsRelation())
+			{
+				*num = m_numRelations;
+				return m_relations;
+			}
+
+			return NULL;
+		}
+
+		ExpressionMD5 m_md5;
+		wxUint64 *m_ways;
+		wxUint64 *m_relations;
+		unsigned m_numWays;
+		unsigned m_numRelations;
+		unsigned m_lastRound; // the RuleCache round in which this was last handed out
+};
+
+WX_DEFINE_ARRAY_PTR(RuleResults *, RuleResultsArray);
+
+// RuleResults by rule MD5, so a rule that is the same as before, in whatever control and however it
+// is written, finds the values evaluated earlier. the cache is meant to be used in rounds: every
+// round fetches the RuleResults of the rules it uses, and only results that weren't fetched in the
+// current round are dropped to make room
+class RuleCache
+{
+	public:
+		RuleCache();
+		~RuleCache();
+
+		// drops everything, and sizes new RuleResults for these numbers of objects
+		void Init(unsigned numWays, unsigned numRelations);
+
+		void StartRound()
+		{
+			m_round++;
+		}
+
+		// the results of the rule with this MD5, new and empty if there are none yet
+		RuleResults *Get(ExpressionMD5 const &md5);
+
+		void ReportMemory(MemoryReport *report);
+
+	private:
+		void Clear();
+
+		RuleResultsArray m_results;
+		unsigned m_numWays;
+		unsigned m_numRelations;
+		unsigned m_round;
+};
+
+// StyleCache values that aren't a rule index
+#define STYLECACHEUNKNOWN 0xFFFF
+#define STYLECACHENONE 0xFFFE
+
+// per way and relation the first color rule that is S_TRUE for it. when a rule changes, only the
+// objects that matched it or a later rule, or none, have to be classified again
+class StyleCache
+{
+	public:
+		StyleCache();
+		~StyleCache();
+
+		// sizes for these numbers of objects, with nothing known
+		void Init(unsigned numWays, unsigned numRelations);
+
+		// false if o isn't known. rule is -1 if no rule matches
+		bool Get(IdObjectWithTags const *o, int *rule) const
+		{
+			unsigned num;
+			wxUint16 const *styles = GetStyles(o, &num);
+
+			if (!styles || o->m_index >= num || styles[o->m_index] == STYLECACHEUNKNOWN)
+			{
+				return false;
+			}
+
+			*rule = styles[o->m_index] == STYLECACHENONE ? -1 : styles[o->m_index];
+			return true;
+		}
+
+		// rule -1 for none
+		void Set(IdObjectWithTags const *o, int rule)
+		{
+			unsigned num;
+			wxUint16 *styles = GetStyles(o, &num);
+
+			if (styles && o->m_index < num && rule < STYLECACHENONE)
+			{
+				styles[o->m_index] = rule < 0 ? STYLECACHENONE : rule;
+			}
+		}
+
+		// forgets the objects whose rule can have changed, when the rules from index first on have
+		void Invalidate(unsigned first);
+
+		void ReportMemory(MemoryReport *report);
+
+	private:
+		StyleCache(StyleCache const &other);
+		StyleCache const &operator=(StyleCache const &other);
+
+		wxUint16 *GetStyles(IdObjectWithTags const *o, unsigned *num) const
+		{
+			if (o->IsWay())
+			{
+				*num = m_numWays;
+				return m_ways;
+			}
+			else if (o->IsRelation())
+			{
+				*num = m_numRelations;
+				return m_relations;
+			}
+
+			return NULL;
+		}
+
+		wxUint16 *m_ways;
+		wxUint16 *m_relations;
+		unsigned m_numWays;
+		unsigned m_numRelations;
+};
+
+#endif
@@ -0,0 +1,424 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#include "ruleclassifier.h"
+
+RuleTagTests::RuleTagTests()
+{
+	m_tests = NULL;
+	m_numTests = 0;
+	m_maxTests = 0;
+	m_keyStart = NULL;
+	m_numKeys = 0;
+}
+
+RuleTagTests::~RuleTagTests()
+{
+	delete [] m_tests;
+	delete [] m_keyStart;
+}
+
+void RuleTagTests::Clear()
+{
+	m_numTests = 0;
+	m_numKeys = 0;
+}
+
+unsigned RuleTagTests::Add(TagIndex const &index)
+{
+	for (unsigned i = 0; i < m_numTests; i++)
+	{
+		if (m_tests[i].m_index.Equal(index))
+		{
+			return m_tests[i].m_number;
+		}
+	}
+
+	if (m_numTests >= m_maxTests)
+	{
+		m_maxTests = m_maxTests ? m_maxTests * 2 : 64;
+		Test *n = new Test[m_maxTests];
+		for (unsigned i = 0; i < m_numTests; i++)
+		{
+			n[i] = m_tests[i];
+		}
+		delete [] m_tests;
+		m_tests = n;
+	}
+
+	m_tests[m_numTests].m_index = index;
+	m_tests[m_numTests].m_number = m_numTests;
+	m_numKeys = 0;
+
+	return m_numTests++;
+}
+
+int RuleTagTests::CompareTests(void const *t1, void const *t2)
+{
+	unsigned k1 = static_cast<Test const *>(t1)->m_index.m_keyIndex;
+	unsigned k2 = static_cast<Test const *>(t2)->m_index.m_keyIndex;
+
+	return k1 < k2 ? -1 : (k1 > k2 ? 1 : 0);
+}
+
+void RuleTagTests::Finish()
+{
+	qsort(m_tests, m_numTests, sizeof(Test), CompareTests);
+
+	// tags that aren't in the store have an invalid index, which no object tag matches. they sort last
+	// and are left out of the table
+	m_numKeys = 0;
+	for (unsigned i = 0; i < m_numTests; i++)
+	{
+		TagIndex index = m_tests[i].m_index;
+		if (index.Valid() && index.m_keyIndex + 1 > m_numKeys)
+		{
+			m_numKeys = index.m_keyIndex + 1;
+		}
+	}
+
+	delete [] m_keyStart;
+	m_keyStart = new unsigned[m_numKeys + 1];
+
+	unsigned t = 0;
+	for (unsigned k = 0; k <= m_numKeys; k++)
+	{
+		while (t < m_numTests && m_tests[t].m_index.m_keyIndex < k)
+		{
+			t++;
+		}
+		m_keyStart[k] = t;
+	}
+}
+
+void RuleTagTests::Run(IdObjectWithTags const *o, wxUint64 *bits) const
+{
+	memset(bits, 0, sizeof(wxUint64) * GetNumWords());
+
+	for (OsmTag const *t = o->m_tags; t; t = static_cast<OsmTag const *>(t->m_next))
+	{
+		unsigned key = t->m_index.m_keyIndex;
+		if (key >= m_numKeys)
+		{
+			continue;
+		}
+
+		unsigned value = t->m_index.m_valueIndex;
+		for (unsigned i = m_keyStart[key]; i < m_keyStart[key + 1]; i++)
+		{
+			unsigned testValue = m_tests[i].m_index.m_valueIndex;
+			if (!testValue || !value || testValue == value)
+			{
+				bits[m_tests[i].m_number >> 6] |= (wxUint64)1 << (m_tests[i].m_number & 63);
+			}
+		}
+	}
+}
+
+RuleSharedExpressions::RuleSharedExpressions()
+{
+	m_entries = NULL;
+	m_num = 0;
+	m_max = 0;
+	m_numShared = 0;
+	m_finished = false;
+}
+
+RuleSharedExpressions::~RuleSharedExpressions()
+{
+	delete [] m_entries;
+}
+
+void RuleSharedExpressions::Clear()
+{
+	m_num = 0;
+	m_numShared = 0;
+	m_finished = false;
+}
+
+void RuleSharedExpressions::Add(LogicalExpression const *expr)
+{
+	// disabled expressions compile to a constant, and leaves to a single instruction, sharing those
+	// gains nothing
+	if (expr->m_disabled || !expr->m_children.GetCount())
+	{
+		return;
+	}
+
+	m_finished = false;
+
+	for (unsigned i = 0; i < expr->m_children.GetCount(); i++)
+	{
+		Add(expr->m_children[i]);
+	}
+
+	ExpressionMD5 const &md5 = expr->MD5();
+	for (unsigned i = 0; i < m_num; i++)
+	{
+		if (!m_entries[i].m_md5.Difference(md5))
+		{
+			m_entries[i].m_count++;
+			return;
+		}
+	}
+
+	if (m_num >= m_max)
+	{
+		m_max = m_max ? m_max * 2 : 64;
+		Entry *n = new Entry[m_max];
+		for (unsigned i = 0; i < m_num; i++)
+		{
+			n[i] = m_entries[i];
+		}
+		delete [] m_entries;
+		m_entries = n;
+	}
+
+	m_entries[m_num].m_md5 = md5;
+	m_entries[m_num].m_count = 1;
+	m_entries[m_num].m_number = -1;
+	m_num++;
+}
+
+int RuleSharedExpressions::CompareEntries(void const *e1, void const *e2)
+{
+	return static_cast<Entry const *>(e1)->m_md5.Difference(static_cast<Entry const *>(e2)->m_md5);
+}
+
+void RuleSharedExpressions::Finish()
+{
+	qsort(m_entries, m_num, sizeof(Entry), CompareEntries);
+
+	m_numShared = 0;
+	for (unsigned i = 0; i < m_num; i++)
+	{
+		m_entries[i].m_number = m_entries[i].m_count > 1 ? (int)m_numShared++ : -1;
+	}
+
+	m_finished = true;
+}
+
+int RuleSharedExpressions::Find(ExpressionMD5 const &md5) const
+{
+	if (!m_finished)
+	{
+		return -1;
+	}
+
+	unsigned lo = 0, hi = m_num;
+	while (lo < hi)
+	{
+		unsigned mid = (lo + hi) / 2;
+		int d = m_entries[mid].m_md5.Difference(md5);
+
+		if (!d)
+		{
+			return m_entries[mid].m_number;
+		}
+		else if (d < 0)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	return -1;
+}
+
+RuleClassifier::RuleClassifier()
+{
+	m_programs = NULL;
+	m_rules = NULL;
+	m_md5s = NULL;
+	m_valid = NULL;
+	m_canIgnore = NULL;
+	m_numRules = 0;
+	m_ruleWords = 0;
+	m_testRules = NULL;
+	m_alwaysRules = NULL;
+	m_testBits = NULL;
+	m_candidates = NULL;
+	m_sharedStates = NULL;
+}
+
+RuleClassifier::~RuleClassifier()
+{
+	Clear();
+}
+
+void RuleClassifier::Clear()
+{
+	delete [] m_programs;
+	delete [] m_rules;
+	delete [] m_md5s;
+	delete [] m_valid;
+	delete [] m_canIgnore;
+	delete [] m_testRules;
+	delete [] m_alwaysRules;
+	delete [] m_testBits;
+	delete [] m_candidates;
+	delete [] m_sharedStates;
+
+	m_programs = NULL;
+	m_rules = NULL;
+	m_md5s = NULL;
+	m_valid = NULL;
+	m_canIgnore = NULL;
+	m_testRules = NULL;
+	m_alwaysRules = NULL;
+	m_testBits = NULL;
+	m_candidates = NULL;
+	m_sharedStates = NULL;
+	m_numRules = 0;
+	m_ruleWords = 0;
+	m_tests.Clear();
+	m_shared.Clear();
+}
+
+void RuleClassifier::Build(Rule **rules, unsigned num)
+{
+	Clear();
+
+	m_numRules = num;
+	m_programs = new RuleProgram[num ? num : 1];
+	m_rules = new Rule *[num ? num : 1];
+	m_md5s = new ExpressionMD5[num ? num : 1];
+	m_valid = new bool[num ? num : 1];
+	m_canIgnore = new bool[num ? num : 1];
+
+	for (unsigned i = 0; i < num; i++)
+	{
+		if (rules[i]->Valid())
+		{
+			m_shared.Add(rules[i]->GetExpression());
+		}
+	}
+	m_shared.Finish();
+	m_sharedStates = new unsigned char[m_shared.GetNum() ? m_shared.GetNum() : 1];
+
+	for (unsigned i = 0; i < num; i++)
+	{
+		m_rules[i] = rules[i];
+		m_valid[i] = rules[i]->Valid();
+		m_canIgnore[i] = true;
+
+		if (m_valid[i])
+		{
+			m_md5s[i] = rules[i]->MD5();
+			m_programs[i].Compile(rules[i]->GetExpression(), &m_tests, &m_shared);
+			m_canIgnore[i] = !m_programs[i].IsCompiled() || m_programs[i].CanBeIgnore();
+		}
+	}
+
+	m_tests.Finish();
+	m_testBits = new wxUint64[m_tests.GetNumWords() ? m_tests.GetNumWords() : 1];
+
+	m_ruleWords = (num + 63) >> 6;
+	unsigned words = m_ruleWords ? m_ruleWords : 1;
+	m_testRules = new wxUint64[m_tests.GetNum() * words + 1];
+	m_alwaysRules = new wxUint64[words];
+	m_candidates = new wxUint64[words];
+	memset(m_testRules, 0, sizeof(wxUint64) * m_tests.GetNum() * words);
+	memset(m_alwaysRules, 0, sizeof(wxUint64) * words);
+
+	for (unsigned i = 0; i < num; i++)
+	{
+		wxUint64 bit = (wxUint64)1 << (i & 63);
+
+		if (!m_valid[i])
+		{
+			continue;
+		}
+
+		if (!m_programs[i].IsCompiled() || m_programs[i].CanBeTrueWithoutTriggers())
+		{
+			m_alwaysRules[i >> 6] |= bit;
+			continue;
+		}
+
+		wxArrayInt const &triggers = m_programs[i].GetTriggers();
+		for (unsigned t = 0; t < triggers.GetCount(); t++)
+		{
+			m_testRules[triggers[t] * m_ruleWords + (i >> 6)] |= bit;
+		}
+	}
+}
+
+unsigned RuleClassifier::GetFirstDifference(Rule **rules, unsigned num) const
+{
+	unsigned common = num < m_numRules ? num : m_numRules;
+
+	for (unsigned i = 0; i < common; i++)
+	{
+		if (rules[i]->Valid() != m_valid[i])
+		{
+			return i;
+		}
+
+		if (m_valid[i] && m_md5s[i].Difference(rules[i]->MD5()))
+		{
+			return i;
+		}
+	}
+
+	return common;
+}
+
+unsigned RuleClassifier::Classify(IdObjectWithTags const *o, unsigned from, unsigned char *states) const
+{
+	m_tests.Run(o, m_testBits);
+	memset(m_sharedStates, RULEPROGRAMUNKNOWN, m_shared.GetNum());
+
+	// the rules that may be S_TRUE: those of the tests that matched
+	memcpy(m_candidates, m_alwaysRules, sizeof(wxUint64) * m_ruleWords);
+	for (unsigned t = 0; t < m_tests.GetNum(); t++)
+	{
+		if (!(m_testBits[t >> 6] & ((wxUint64)1 << (t & 63))))
+		{
+			continue;
+		}
+
+		wxUint64 const *rules = m_testRules + t * m_ruleWords;
+		for (unsigned r = 0; r < m_ruleWords; r++)
+		{
+			m_candidates[r] |= rules[r];
+		}
+	}
+
+	for (unsigned i = from; i < m_numRules; i++)
+	{
+		unsigned char s = LogicalExpression::S_IGNORE;
+
+		if (!m_valid[i])
+		{
+			// invalid rules are S_IGNORE for everything
+		}
+		else if (!(m_candidates[i >> 6] & ((wxUint64)1 << (i & 63))))
+		{
+			s = m_canIgnore[i] ? RULECLASSIFIERNOTEVALUATED : LogicalExpression::S_FALSE;
+		}
+		else if (m_programs[i].IsCompiled())
+		{
+			s = m_programs[i].Run(o, m_testBits, m_sharedStates);
+		}
+		else
+		{
+			s = m_rules[i]->Evaluate(const_cast<IdObjectWithTags *>(o), false);
+		}
+
+		if (states)
+		{
+			states[i] = s;
+		}
+
+		if (s == LogicalExpression::S_TRUE)
+		{
+			return i;
+		}
+	}
+
+	return m_numRules;
+}
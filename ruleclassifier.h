@@ -0,0 +1,171 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#ifndef __RULECLASSIFIER_H__
+#define __RULECLASSIFIER_H__
+
+#include "s_expr.h"
+
+// the distinct tag tests of a set of rules. Run() does all of them for an object in one pass over its
+// tags, so a tag that several rules test for is only looked for once
+class RuleTagTests
+{
+	public:
+		RuleTagTests();
+		~RuleTagTests();
+
+		void Clear();
+
+		// the number of the test for index, a new one if there is none yet. invalidates the lookup
+		// table until Finish() is called
+		unsigned Add(TagIndex const &index);
+
+		// builds the lookup table, after the last Add()
+		void Finish();
+
+		unsigned GetNum() const
+		{
+			return m_numTests;
+		}
+
+		unsigned GetNumWords() const
+		{
+			return (m_numTests + 63) >> 6;
+		}
+
+		// sets bit t of bits, which must hold GetNumWords() words, if a tag of o matches test t, and
+		// clears it otherwise
+		void Run(IdObjectWithTags const *o, wxUint64 *bits) const;
+
+	private:
+		RuleTagTests(RuleTagTests const &other);
+		RuleTagTests const &operator=(RuleTagTests const &other);
+
+		class Test
+		{
+			public:
+				TagIndex m_index;
+				unsigned m_number;
+		};
+
+		static int CompareTests(void const *t1, void const *t2);
+
+		Test *m_tests;      // sorted on key after Finish()
+		unsigned m_numTests;
+		unsigned m_maxTests;
+
+		// per key below m_numKeys, the tests on it are m_tests[m_keyStart[key]] up to
+		// m_tests[m_keyStart[key + 1]]
+		unsigned *m_keyStart;
+		unsigned m_numKeys;
+};
+
+// the and/or/not subexpressions that occur more than once in a set of rules, by MD5. a program
+// compiled with them evaluates each once per object, whichever rule needs it first
+class RuleSharedExpressions
+{
+	public:
+		RuleSharedExpressions();
+		~RuleSharedExpressions();
+
+		void Clear();
+
+		// counts the subexpressions of expr. invalidates the numbers until Finish() is called
+		void Add(LogicalExpression const *expr);
+
+		// numbers the subexpressions that were added more than once, after the last Add()
+		void Finish();
+
+		// the number of the shared subexpression with this MD5, -1 if it isn't shared
+		int Find(ExpressionMD5 const &md5) const;
+
+		unsigned GetNum() const
+		{
+			return m_numShared;
+		}
+
+	private:
+		RuleSharedExpressions(RuleSharedExpressions const &other);
+		RuleSharedExpressions const &operator=(RuleSharedExpressions const &other);
+
+		class Entry
+		{
+			public:
+				ExpressionMD5 m_md5;
+				unsigned m_count;
+				int m_number;
+		};
+
+		static int CompareEntries(void const *e1, void const *e2);
+
+		Entry *m_entries;   // sorted on MD5 after Finish()
+		unsigned m_num;
+		unsigned m_max;
+		unsigned m_numShared;
+		bool m_finished;
+};
+
+// the state Classify() stores for a rule it didn't need to evaluate, and doesn't know the value of
+#define RULECLASSIFIERNOTEVALUATED 0xFF
+
+// a list of rules compiled together, which finds the first one that is S_TRUE for an object. the tag
+// tests are shared between the rules and done once per object, and a rule is only evaluated if one of
+// the tags that it needs to be S_TRUE is there
+class RuleClassifier
+{
+	public:
+		RuleClassifier();
+		~RuleClassifier();
+
+		// compiles the rules, in order. the rules have to stay alive until the next Build() or
+		// Clear(). invalid rules are S_IGNORE for everything
+		void Build(Rule **rules, unsigned num);
+		void Clear();
+
+		// true if the classifier was built from rules with the same expressions
+		bool IsBuiltFrom(Rule **rules, unsigned num) const
+		{
+			return num == m_numRules && GetFirstDifference(rules, num) == num;
+		}
+
+		// the index of the first rule with another expression than the classifier was built from.
+		// if one list is longer, the length of the shorter one
+		unsigned GetFirstDifference(Rule **rules, unsigned num) const;
+
+		unsigned GetNumRules() const
+		{
+			return m_numRules;
+		}
+
+		// the first rule from 'from' on that is S_TRUE for o, GetNumRules() if there is none. if
+		// states isn't NULL, the LogicalExpression::STATE of the rules up to that one is stored in
+		// it, at the index of the rule, or RULECLASSIFIERNOTEVALUATED for a rule that was skipped
+		// and may be S_FALSE or S_IGNORE
+		unsigned Classify(IdObjectWithTags const *o, unsigned from = 0, unsigned char *states = NULL) const;
+
+	private:
+		RuleClassifier(RuleClassifier const &other);
+		RuleClassifier const &operator=(RuleClassifier const &other);
+
+		RuleTagTests m_tests;
+		RuleSharedExpressions m_shared;
+		RuleProgram *m_programs;
+		Rule **m_rules;          // for rules that nest too deep to compile
+		ExpressionMD5 *m_md5s;   // of the valid rules
+		bool *m_valid;
+		bool *m_canIgnore;       // false if a rule is S_FALSE whenever it isn't S_TRUE
+		unsigned m_numRules;
+
+		// bit sets of rules, m_ruleWords words each: per test the rules that may be S_TRUE if it
+		// is, and the rules that may be S_TRUE without any test
+		unsigned m_ruleWords;
+		wxUint64 *m_testRules;
+		wxUint64 *m_alwaysRules;
+
+		// scratch space for Classify(), rendering is single threaded
+		mutable wxUint64 *m_testBits;
+		mutable wxUint64 *m_candidates;
+		mutable unsigned char *m_sharedStates;
+};
+
+#endif
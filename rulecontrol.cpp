@@ -7,6 +7,7 @@
 
 BEGIN_EVENT_TABLE(RuleControl, wxTextCtrl)
 	EVT_TEXT(-1, RuleControl::OnText)
+	EVT_TIMER(-1, RuleControl::OnApplyTimer)
 END_EVENT_TABLE()
 
 BEGIN_EVENT_TABLE(ColorPicker, wxColourPickerCtrl)
@@ -34,10 +35,12 @@ END_EVENT_TABLE()
 
 
 RuleControl::RuleControl(wxWindow *parent, OsmCanvas *canvas, wxSize const &size)
-	: wxTextCtrl(parent, -1, wxEmptyString, wxDefaultPosition, size == wxDefaultSize ? wxSize(200,40) : size, wxTE_MULTILINE | wxTE_RICH | wxTE_PROCESS_TAB)
+	: wxTextCtrl(parent, -1, wxEmptyString, wxDefaultPosition, size == wxDefaultSize ? wxSize(200,40) : size, wxTE_MULTILINE | wxTE_RICH | wxTE_PROCESS_TAB),
+	m_applyTimer(this)
 {
 	m_canvas = canvas;
 	m_valueOnEmpty = true;
+	m_hasPending = false;
 }
 
 RuleControl::~RuleControl()
@@ -52,20 +55,51 @@ void RuleControl::OnText(wxCommandEvent &evt)
 
 	if (newRule.IsValid() || GetValue().Trim().IsEmpty())
 	{
+		SetToolTip(wxT("expression ok"));
+
+		// applied when the typing stops. an edit that gives the same rule again only cancels the
+		// pending one
 		if (newRule.Differs(m_rule))
 		{
-			m_rule = newRule;
-		
-			m_canvas->Redraw();
-			SetToolTip(wxT("expression ok"));
+			m_pendingRule = newRule;
+			m_hasPending = true;
+			m_applyTimer.Start(RULEAPPLYDELAY, wxTIMER_ONE_SHOT);
+		}
+		else
+		{
+			m_hasPending = false;
+			m_applyTimer.Stop();
 		}
 	}
 	else
 	{
+		// keep drawing with the last valid rule while the text is invalid
+		m_hasPending = false;
+		m_applyTimer.Stop();
 		SetToolTip(newRule.GetErrorLog());
 	}
 }
 
+void RuleControl::OnApplyTimer(wxTimerEvent &evt)
+{
+	ApplyPending();
+}
+
+void RuleControl::ApplyPending()
+{
+	m_applyTimer.Stop();
+
+	if (!m_hasPending)
+	{
+		return;
+	}
+
+	m_rule = m_pendingRule;
+	m_rule.BuildTables();
+	m_hasPending = false;
+	m_canvas->Redraw();
+}
+
 void RuleControl::SetColor(int from, int to, E_COLORS color)
 {
 	static wxColour bg(155,255,155);
@@ -102,12 +136,25 @@ LogicalExpression::STATE RuleControl::Evaluate(IdObjectWithTags *o)
 {
 	if (m_rule.Valid())
 	{
-		return m_rule.Evaluate(o);
+		return m_rule.Evaluate(o, false);
 	}
 
 	return LogicalExpression::S_IGNORE;
 }
 
+unsigned RuleControl::CountMatching(TagPostings const &postings, IdObject::KIND kind)
+{
+	if (!m_rule.Valid())
+	{
+		return postings.GetNumObjects();
+	}
+
+	IndexBitset trueSet(postings.GetNumObjects()), falseSet(postings.GetNumObjects());
+	m_rule.Select(postings, kind, &trueSet, &falseSet);
+
+	return postings.GetNumObjects() - falseSet.Count();
+}
+
 
 
 void ColorRules::Add()
@@ -230,6 +277,8 @@ void RuleControl::Load(wxString const &group)
 
 	SetValue(config->Read(key, wxEmptyString));
 
+	// loaded rules don't wait for more typing
+	ApplyPending();
 }
 
 
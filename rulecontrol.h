@@ -12,6 +12,7 @@
 #include <wx/combobox.h>
 #include <wx/config.h>
 #include <wx/choice.h>
+#include <wx/timer.h>
 
 #include "s_expr.h"
 #include "osmcanvas.h"
@@ -19,6 +20,9 @@
 
 #define NUMLAYERS 3
 
+// milliseconds a rule has to stay unedited before it is applied
+#define RULEAPPLYDELAY 400
+
 class RuleControl
 	: public wxTextCtrl, public RuleDisplay
 {
@@ -29,6 +33,28 @@ class RuleControl
 
 		LogicalExpression::STATE Evaluate(IdObjectWithTags *o);
 
+		// shows the profile of the copy of the rule that was drawn with as the tooltip, see
+		// RuleSet::ColorRuleProfileText()
+		void ShowProfile(wxString const &profile)
+		{
+			SetToolTip(profile.IsEmpty() ? wxString(wxT("no profile")) : profile);
+		}
+
+		// Evaluate() is S_IGNORE for everything if the rule isn't valid
+		bool Valid()
+		{
+			return m_rule.Valid();
+		}
+
+		// changes when the text is edited
+		Rule *GetRule()
+		{
+			return &m_rule;
+		}
+
+		// how many objects in postings Evaluate() isn't S_FALSE for, using the posting lists
+		unsigned CountMatching(TagPostings const &postings, IdObject::KIND kind);
+
 		void Save(wxString const &group);
 		void Load(wxString const &group);
 
@@ -40,11 +66,20 @@ class RuleControl
 		DECLARE_EVENT_TABLE();
 
 		void OnText(wxCommandEvent &evt);
+		void OnApplyTimer(wxTimerEvent &evt);
+
+		// makes the pending rule the current one, and redraws
+		void ApplyPending();
 
 		virtual void SetColor(int from, int to, RuleDisplay::E_COLORS color);
 
 		Rule m_rule;
 
+		// an edit that isn't applied yet, so typing doesn't restart the drawing for every key
+		Rule m_pendingRule;
+		bool m_hasPending;
+		wxTimer m_applyTimer;
+
 		OsmCanvas *m_canvas;
 		bool m_valueOnEmpty;
 };
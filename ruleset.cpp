@@ -0,0 +1,119 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#include "ruleset.h"
+#include "rulecontrol.h"
+
+RuleSet::RuleSet(RuleControl *drawRule, ColorRules *colorRules, RuleScale const &scale)
+{
+	m_refCount = 0;
+	m_scale = scale;
+	m_drawRule = NULL;
+	m_numColorRules = colorRules ? colorRules->m_num : 0;
+	m_colorRules = new Rule *[m_numColorRules ? m_numColorRules : 1];
+	m_styles = new RuleStyle[m_numColorRules ? m_numColorRules : 1];
+
+	m_md5.Init();
+
+	if (drawRule)
+	{
+		m_drawRule = new Rule(*drawRule->GetRule(), scale);
+		m_drawRule->BuildTables();
+	}
+
+	char valid = GetDrawRule() != NULL;
+	m_md5.Add(&valid, 1);
+	if (valid)
+	{
+		m_md5.Add(m_drawRule->MD5());
+	}
+
+	for (unsigned i = 0; i < m_numColorRules; i++)
+	{
+		m_colorRules[i] = new Rule(*colorRules->m_rules[i]->GetRule(), scale);
+		m_colorRules[i]->BuildTables();
+
+		RuleStyle &style = m_styles[i];
+		style.m_colour = colorRules->m_pickers[i]->GetColour();
+		style.m_polygon = colorRules->m_checkBoxes[i]->IsChecked();
+		style.m_layer = colorRules->m_layers[i]->GetSelection();
+
+		unsigned char s[6] = { style.m_colour.Red(), style.m_colour.Green(), style.m_colour.Blue(), style.m_colour.Alpha(), style.m_polygon, (unsigned char)style.m_layer };
+		m_md5.Add(s, 6);
+
+		valid = m_colorRules[i]->Valid();
+		m_md5.Add(&valid, 1);
+		if (valid)
+		{
+			m_md5.Add(m_colorRules[i]->MD5());
+		}
+	}
+
+	m_md5.Finish();
+}
+
+RuleSet::~RuleSet()
+{
+	delete m_drawRule;
+
+	for (unsigned i = 0; i < m_numColorRules; i++)
+	{
+		delete m_colorRules[i];
+	}
+
+	delete [] m_colorRules;
+	delete [] m_styles;
+}
+
+bool RuleSet::IsSnapshotOf(RuleControl *drawRule, ColorRules *colorRules, RuleScale const &scale) const
+{
+	if (!(scale == m_scale) || !drawRule != !m_drawRule || (colorRules ? colorRules->m_num : 0) != (int)m_numColorRules)
+	{
+		return false;
+	}
+
+	// the text is what the rule was parsed from, the same text gives the same rule
+	if (drawRule && drawRule->GetRule()->GetText() != m_drawRule->GetText())
+	{
+		return false;
+	}
+
+	for (unsigned i = 0; i < m_numColorRules; i++)
+	{
+		RuleStyle const &style = m_styles[i];
+
+		if (colorRules->m_rules[i]->GetRule()->GetText() != m_colorRules[i]->GetText()
+			|| colorRules->m_pickers[i]->GetColour() != style.m_colour
+			|| colorRules->m_checkBoxes[i]->IsChecked() != style.m_polygon
+			|| colorRules->m_layers[i]->GetSelection() != style.m_layer)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void RuleSet::ClearProfile()
+{
+	if (m_drawRule)
+	{
+		m_drawRule->ClearProfile();
+	}
+
+	for (unsigned i = 0; i < m_numColorRules; i++)
+	{
+		m_colorRules[i]->ClearProfile();
+	}
+}
+
+wxString RuleSet::DrawRuleProfileText() const
+{
+	return m_drawRule ? m_drawRule->ProfileText() : wxString();
+}
+
+wxString RuleSet::ColorRuleProfileText(unsigned colorRule) const
+{
+	assert(colorRule < m_numColorRules);
+	return m_colorRules[colorRule]->ProfileText();
+}
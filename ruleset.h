@@ -0,0 +1,120 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#ifndef __RULESET_H__
+#define __RULESET_H__
+
+#include "s_expr.h"
+#include "tagsummary.h"
+#include <wx/colour.h>
+#include <wx/atomic.h>
+
+class RuleControl;
+class ColorRules;
+
+// how the objects that a color rule matches are drawn. the default is for objects no rule matches
+class RuleStyle
+{
+	public:
+		RuleStyle()
+		{
+			m_colour = wxColour(150, 150, 150);
+			m_polygon = false;
+			m_layer = 1;
+		}
+
+		wxColour m_colour;
+		bool m_polygon;
+		int m_layer;
+};
+
+// the draw rule and the color rules with their styles, copied from the controls, and evaluated at one
+// scale, with the tables of the rules built. it doesn't change after that, and doesn't use the
+// controls, so render jobs can share it, also on other threads, as long as they don't profile the
+// rules: the profile counts are written while evaluating. like the tile lists it is reference counted:
+// it starts without references, and the last UnRef() deletes it
+class RuleSet
+{
+	public:
+		// reads the controls, so only on the gui thread. either may be NULL
+		RuleSet(RuleControl *drawRule, ColorRules *colorRules, RuleScale const &scale);
+
+		void Ref()
+		{
+			wxAtomicInc(m_refCount);
+		}
+
+		void UnRef()
+		{
+			if (!wxAtomicDec(m_refCount))
+			{
+				delete this;
+			}
+		}
+
+		// true if the controls hold the same rules and styles as when it was made from them, and it is
+		// for this scale
+		bool IsSnapshotOf(RuleControl *drawRule, ColorRules *colorRules, RuleScale const &scale) const;
+
+		RuleScale const &GetScale() const
+		{
+			return m_scale;
+		}
+
+		// NULL if there is no valid draw rule. everything is drawn then
+		Rule *GetDrawRule() const
+		{
+			return m_drawRule && m_drawRule->Valid() ? m_drawRule : NULL;
+		}
+
+		// false if the draw rule hides all objects summary describes
+		bool CanDraw(TagSummary const &summary) const
+		{
+			Rule *rule = GetDrawRule();
+
+			return !rule || (rule->GetPossibleStates(summary) & (STATEBIT(LogicalExpression::S_TRUE) | STATEBIT(LogicalExpression::S_IGNORE)));
+		}
+
+		unsigned GetNumColorRules() const
+		{
+			return m_numColorRules;
+		}
+
+		// the color rules in order, invalid ones included, so the indices match the styles
+		Rule **GetColorRules() const
+		{
+			return m_colorRules;
+		}
+
+		RuleStyle const &GetStyle(unsigned colorRule) const
+		{
+			assert(colorRule < m_numColorRules);
+			return m_styles[colorRule];
+		}
+
+		// of the rules at this scale and the styles
+		ExpressionMD5 const &MD5() const
+		{
+			return m_md5;
+		}
+
+		// the profiles of the rules, see Rule::ProfileText(). profiling is for one job at a time
+		void ClearProfile();
+		wxString DrawRuleProfileText() const;
+		wxString ColorRuleProfileText(unsigned colorRule) const;
+
+	private:
+		RuleSet(RuleSet const &other);
+		RuleSet const &operator=(RuleSet const &other);
+		~RuleSet();
+
+		RuleScale m_scale;
+		Rule *m_drawRule;
+		Rule **m_colorRules;
+		RuleStyle *m_styles;
+		unsigned m_numColorRules;
+		ExpressionMD5 m_md5;
+		wxAtomicInt m_refCount;
+};
+
+#endif
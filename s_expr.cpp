@@ -2,6 +2,8 @@
 // copyright Martijn Versteegh
 // osmbrowser is licenced under the gpl v3
 #include "s_expr.h"
+#include "ruleclassifier.h"
+#include <time.h>
 
 
 char const *Type::s_typeNames[] =
@@ -13,16 +15,694 @@ char const *Type::s_typeNames[] =
 
 unsigned Type::s_numTypes = sizeof(Type::s_typeNames) / sizeof(char *);
 
+bool LogicalExpression::s_profiling = false;
+
+LogicalExpression::STATE LogicalExpression::ProfiledValue(IdObjectWithTags *o)
+{
+	timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	STATE ret = GetValue(o, true);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	m_profile.m_calls++;
+	m_profile.m_states[ret]++;
+	m_profile.m_nanoseconds += (wxUint64)(end.tv_sec - start.tv_sec) * 1000000000 + end.tv_nsec - start.tv_nsec;
+
+	return ret;
+}
+
+bool LogicalExpression::BuildTables()
+{
+	bool ret = false;
+
+	for (unsigned i = 0; i < m_children.GetCount(); i++)
+	{
+		ret |= m_children[i]->BuildTables();
+	}
+
+	return ret;
+}
+
+void LogicalExpression::CloneInto(LogicalExpression *to) const
+{
+	to->m_disabled = m_disabled;
+	to->m_spanStart = m_spanStart;
+	to->m_spanEnd = m_spanEnd;
+	to->m_md5 = m_md5;
+	to->m_md5Valid = m_md5Valid;
+
+	for (unsigned i = 0; i < m_children.GetCount(); i++)
+	{
+		to->m_children.Add(m_children[i]->Clone());
+	}
+}
+
+void LogicalExpression::ClearProfile()
+{
+	m_profile.Clear();
+
+	for (unsigned i = 0; i < m_children.GetCount(); i++)
+	{
+		m_children[i]->ClearProfile();
+	}
+}
+
+void LogicalExpression::ProfileText(wxString *text, char const *source, int indent) const
+{
+	// the extra tags of a (tag "key" "value1" "value2") are made by the parser, and have no text of
+	// their own
+	wxString part = m_spanEnd > m_spanStart ? wxString::FromUTF8(source + m_spanStart, m_spanEnd - m_spanStart) : wxString(wxT("(part of the above)"));
+	part.Replace(wxT("\n"), wxT(" "));
+	if (part.Len() > 60)
+	{
+		part = part.Left(57) + wxT("...");
+	}
+
+	*text += wxString::Format(wxT("%s %*s%s\n"), MD5().ShortHex().c_str(), indent * 2, wxT(""), part.c_str());
+	*text += wxString::Format(wxT("         %*scalls %u true %u false %u ignore %u time %.3f ms\n"), indent * 2, wxT(""),
+		m_profile.m_calls, m_profile.m_states[S_TRUE], m_profile.m_states[S_FALSE], m_profile.m_states[S_IGNORE], m_profile.m_nanoseconds / 1e6);
+
+	for (unsigned i = 0; i < m_children.GetCount(); i++)
+	{
+		m_children[i]->ProfileText(text, source, indent + 1);
+	}
+}
+
+bool LogicalExpression::SetScale(RuleScale const &scale)
+{
+	bool changed = false;
+
+	for (unsigned i = 0; i < m_children.GetCount(); i++)
+	{
+		changed |= m_children[i]->SetScale(scale);
+	}
+
+	if (changed)
+	{
+		m_md5Valid = false;
+	}
+
+	return changed;
+}
+
+double MinPixels::GetSize(IdObjectWithTags const *o)
+{
+	DRect bb;
+
+	if (o->IsRelation())
+	{
+		bb = static_cast<OsmRelation *>(const_cast<IdObjectWithTags *>(o))->GetBB();
+	}
+	else if (o->IsWay())
+	{
+		bb = static_cast<OsmWay *>(const_cast<IdObjectWithTags *>(o))->GetBB();
+	}
+	else
+	{
+		return 0;
+	}
+
+	// a way without resolved nodes has an empty box
+	if (bb.m_w < 0)
+	{
+		return 0;
+	}
+
+	return bb.m_w > bb.m_h ? bb.m_w : bb.m_h;
+}
+
 int CompareLogicalExpressionPtrs(LogicalExpression **p1, LogicalExpression **p2)
 {
 	return (*p1)->MD5().Difference((*p2)->MD5());
 }
 
+RuleProgram::RuleProgram()
+{
+	m_code = NULL;
+	m_num = 0;
+	m_max = 0;
+	m_compiled = false;
+	m_tests = NULL;
+	m_shared = NULL;
+	m_anyTrigger = true;
+	m_canIgnore = true;
+}
+
+RuleProgram::~RuleProgram()
+{
+	delete [] m_code;
+}
+
+void RuleProgram::Clear()
+{
+	m_num = 0;
+	m_compiled = false;
+	m_matchers.Clear();
+	m_sizes.Clear();
+}
+
+void RuleProgram::CopyFrom(RuleProgram const &other)
+{
+	Clear();
+
+	if (m_max < other.m_num)
+	{
+		delete [] m_code;
+		m_max = other.m_num;
+		m_code = new Instruction[m_max];
+	}
+
+	if (other.m_num)
+	{
+		memcpy(m_code, other.m_code, other.m_num * sizeof(Instruction));
+	}
+
+	m_num = other.m_num;
+	m_compiled = other.m_compiled;
+	m_matchers = other.m_matchers;
+	m_sizes = other.m_sizes;
+	m_triggers = other.m_triggers;
+	m_anyTrigger = other.m_anyTrigger;
+	m_canIgnore = other.m_canIgnore;
+}
+
+bool RuleProgram::Compile(LogicalExpression const *expr, RuleTagTests *tests, RuleSharedExpressions const *shared)
+{
+	Clear();
+
+	m_compiled = true;
+	m_tests = tests;
+	m_shared = shared;
+	CompileChild(expr, 0);
+	m_tests = NULL;
+	m_shared = NULL;
+
+	// EmitCombine() clears m_compiled when it runs out of slots
+	if (!m_compiled)
+	{
+		m_num = 0;
+	}
+
+	return m_compiled;
+}
+
+RuleProgram::Instruction *RuleProgram::Emit(OPCODE op)
+{
+	if (m_num >= m_max)
+	{
+		m_max = m_max ? m_max * 2 : 16;
+		Instruction *n = new Instruction[m_max];
+		if (m_num)
+		{
+			memcpy(n, m_code, m_num * sizeof(Instruction));
+		}
+		delete [] m_code;
+		m_code = n;
+	}
+
+	Instruction *ret = m_code + m_num++;
+	ret->m_op = op;
+	ret->m_jumpIf = RULEPROGRAMNOJUMP;
+	ret->m_save = SAVE_NONE;
+	ret->m_slot = 0;
+	ret->m_target = 0;
+	ret->m_arg = 0;
+	ret->m_arg2 = 0;
+
+	return ret;
+}
+
+void RuleProgram::CompileChild(LogicalExpression const *child, unsigned slot)
+{
+	int shared = (m_shared && !child->m_disabled) ? m_shared->Find(child->MD5()) : -1;
+
+	if (shared < 0)
+	{
+		child->Compile(this, slot);
+		return;
+	}
+
+	unsigned start = m_num;
+	Emit(OP_LOADSHARED)->m_arg = shared;
+	child->Compile(this, slot);
+
+	// code this short is as cheap as the lookup. it has no jumps, as and/or of more than one child
+	// take at least three instructions, so it can just be moved back
+	if (m_num <= start + 3)
+	{
+		memmove(m_code + start, m_code + start + 1, (m_num - start - 1) * sizeof(Instruction));
+		m_num--;
+		return;
+	}
+
+	// a known value skips the code, to the store, which also does the jump or save the code's last
+	// instruction would have done
+	Emit(OP_STORESHARED)->m_arg = shared;
+	m_code[start].m_arg2 = m_num - 1;
+}
+
+void RuleProgram::EmitTag(TagIndex const &index)
+{
+	m_triggers.Clear();
+	m_anyTrigger = !m_tests;
+	m_canIgnore = false;
+
+	if (m_tests)
+	{
+		unsigned test = m_tests->Add(index);
+		m_triggers.Add(test);
+		Emit(OP_TEST)->m_arg = test;
+		return;
+	}
+
+	Instruction *i = Emit(OP_TAG);
+	i->m_arg = index.m_keyIndex;
+	i->m_arg2 = index.m_valueIndex;
+}
+
+void RuleProgram::EmitValue(ValueMatcher *matcher)
+{
+	m_triggers.Clear();
+	m_anyTrigger = !m_tests;
+	m_canIgnore = false;
+
+	// only objects with the key can match. the test for the key is only there to pick the rules to
+	// evaluate, the value is tested by the instruction
+	if (m_tests)
+	{
+		m_triggers.Add(m_tests->Add(matcher->GetKey()));
+	}
+
+	Instruction *i = Emit(OP_VALUE);
+	i->m_arg = matcher->GetKey().m_keyIndex;
+	i->m_arg2 = m_matchers.GetCount();
+	m_matchers.Add(matcher);
+}
+
+void RuleProgram::EmitKind(IdObject::KIND kind)
+{
+	m_triggers.Clear();
+	m_anyTrigger = true;
+	m_canIgnore = false;
+
+	Emit(OP_KIND)->m_arg = kind;
+}
+
+void RuleProgram::EmitSize(double minSize)
+{
+	m_triggers.Clear();
+	m_anyTrigger = true;
+	m_canIgnore = false;
+
+	Emit(OP_SIZE)->m_arg = m_sizes.GetCount();
+	m_sizes.Add(minSize);
+}
+
+void RuleProgram::EmitConst(LogicalExpression::STATE s)
+{
+	m_triggers.Clear();
+	m_anyTrigger = s == LogicalExpression::S_TRUE;
+	m_canIgnore = s == LogicalExpression::S_IGNORE;
+
+	Emit(OP_CONST)->m_arg = s;
+}
+
+void RuleProgram::EmitNot()
+{
+	static unsigned char const notStates[] = { LogicalExpression::S_TRUE, LogicalExpression::S_FALSE, LogicalExpression::S_IGNORE };
+	Instruction *last = m_code + m_num - 1;
+
+	// an expression that compiled to a constant is a single OP_CONST, as the last instruction
+	if (last->m_op == OP_CONST && last->m_save == SAVE_NONE)
+	{
+		EmitConst(static_cast<LogicalExpression::STATE>(notStates[last->m_arg]));
+		m_code[m_num - 2] = m_code[m_num - 1];
+		m_num--;
+		return;
+	}
+
+	// not is S_TRUE where the tests are false
+	m_triggers.Clear();
+	m_anyTrigger = true;
+
+	Emit(OP_NOT);
+}
+
+void RuleProgram::EmitCombine(LogicalExpressionArray const &children, LogicalExpression::STATE shortCircuit, unsigned slot)
+{
+	// per child that isn't left out, its last instruction: the one that sets its value
+	wxArrayInt ends;
+	unsigned combineStart = m_num;
+
+	// both are only S_TRUE if a child is, so the tests of all children will do. and is only S_TRUE if
+	// none of the children is S_FALSE, so for a child that can't be S_IGNORE either, that child has to
+	// be S_TRUE, and its own tests will do. the shortest of those is taken
+	wxArrayInt allTriggers, bestTriggers;
+	bool allAny = false, allCanIgnore = true, haveBest = false;
+
+	for (unsigned i = 0; i < children.GetCount(); i++)
+	{
+		if (children[i]->m_disabled)
+		{
+			continue;
+		}
+
+		unsigned start = m_num;
+		CompileChild(children[i], slot + 1);
+
+		// a child that is always S_IGNORE doesn't change the value. constants are always S_IGNORE, as
+		// nothing turns an S_IGNORE into another value
+		if (m_num == start + 1 && m_code[start].m_op == OP_CONST && m_code[start].m_arg == LogicalExpression::S_IGNORE)
+		{
+			m_num = start;
+			continue;
+		}
+
+		// a constant shortCircuit, like a (zoom) that is S_FALSE in an and, decides the whole
+		// expression, the code of the other children is dropped
+		if (m_num == start + 1 && m_code[start].m_op == OP_CONST && m_code[start].m_arg == (unsigned)shortCircuit)
+		{
+			m_num = combineStart;
+			EmitConst(shortCircuit);
+			return;
+		}
+
+		ends.Add(m_num - 1);
+
+		for (unsigned t = 0; t < m_triggers.GetCount(); t++)
+		{
+			allTriggers.Add(m_triggers[t]);
+		}
+		allAny |= m_anyTrigger;
+		allCanIgnore &= m_canIgnore;
+
+		if (!m_canIgnore && !m_anyTrigger && (!haveBest || m_triggers.GetCount() < bestTriggers.GetCount()))
+		{
+			bestTriggers = m_triggers;
+			haveBest = true;
+		}
+	}
+
+	if (!ends.GetCount())
+	{
+		EmitConst(LogicalExpression::S_IGNORE);
+		return;
+	}
+
+	m_canIgnore = allCanIgnore;
+	if (shortCircuit == LogicalExpression::S_FALSE && haveBest)
+	{
+		m_triggers = bestTriggers;
+		m_anyTrigger = false;
+	}
+	else
+	{
+		m_triggers = allTriggers;
+		m_anyTrigger = allAny;
+	}
+
+	// and/or of one expression is that expression
+	if (ends.GetCount() == 1)
+	{
+		return;
+	}
+
+	if (slot >= RULEPROGRAMMAXSLOTS)
+	{
+		m_compiled = false;
+		return;
+	}
+
+	// the slot remembers whether any child gave the value that isn't shortCircuit. a child that gives
+	// shortCircuit jumps to the final OP_LOADIFIGNORE, which leaves it in the result. the last child
+	// needs no jump: its value is the result, unless it is S_IGNORE
+	Emit(OP_LOADIFIGNORE)->m_arg = slot;
+
+	for (unsigned i = 0; i + 1 < ends.GetCount(); i++)
+	{
+		Instruction *end = m_code + ends[i];
+		assert(end->m_jumpIf == RULEPROGRAMNOJUMP && end->m_save == SAVE_NONE);
+
+		end->m_jumpIf = shortCircuit;
+		end->m_target = m_num - 1;
+		end->m_save = i ? SAVE_ACCUMULATE : SAVE_STORE;
+		end->m_slot = slot;
+	}
+}
+
+LogicalExpression::STATE RuleProgram::Run(IdObjectWithTags const *o, wxUint64 const *testBits, unsigned char *sharedStates) const
+{
+	static unsigned char const notStates[] = { LogicalExpression::S_TRUE, LogicalExpression::S_FALSE, LogicalExpression::S_IGNORE };
+	unsigned slots[RULEPROGRAMMAXSLOTS];
+	unsigned result = LogicalExpression::S_IGNORE;
+	Instruction const *code = m_code;
+	Instruction const *end = m_code + m_num;
+
+	// tests in order of how common the opcodes are. a chain of predictable branches is cheaper here
+	// than the indirect jump of a switch
+	for (Instruction const *i = code; i < end; i++)
+	{
+		if (i->m_op == OP_TAG)
+		{
+			unsigned key = i->m_arg;
+			unsigned value = i->m_arg2;
+
+			result = LogicalExpression::S_FALSE;
+			for (OsmTag const *t = o->m_tags; t; t = static_cast<OsmTag const *>(t->m_next))
+			{
+				if (t->m_index.m_keyIndex == key && (!value || !t->m_index.m_valueIndex || t->m_index.m_valueIndex == value))
+				{
+					result = LogicalExpression::S_TRUE;
+					break;
+				}
+			}
+		}
+		else if (i->m_op == OP_TEST)
+		{
+			result = (testBits[i->m_arg >> 6] >> (i->m_arg & 63)) & 1 ? LogicalExpression::S_TRUE : LogicalExpression::S_FALSE;
+		}
+		else if (i->m_op == OP_LOADIFIGNORE)
+		{
+			if (result == LogicalExpression::S_IGNORE)
+			{
+				result = slots[i->m_arg];
+			}
+		}
+		else if (i->m_op == OP_NOT)
+		{
+			result = notStates[result];
+		}
+		else if (i->m_op == OP_KIND)
+		{
+			result = o->m_kind == i->m_arg ? LogicalExpression::S_TRUE : LogicalExpression::S_FALSE;
+		}
+		else if (i->m_op == OP_VALUE)
+		{
+			ValueMatcher const *matcher = m_matchers[i->m_arg2];
+
+			result = LogicalExpression::S_FALSE;
+			for (OsmTag const *t = o->m_tags; t; t = static_cast<OsmTag const *>(t->m_next))
+			{
+				if (t->m_index.m_keyIndex == i->m_arg && matcher->Matches(t->m_index.m_valueIndex))
+				{
+					result = LogicalExpression::S_TRUE;
+					break;
+				}
+			}
+		}
+		else if (i->m_op == OP_SIZE)
+		{
+			result = MinPixels::GetSize(o) >= m_sizes[i->m_arg] ? LogicalExpression::S_TRUE : LogicalExpression::S_FALSE;
+		}
+		else if (i->m_op == OP_LOADSHARED)
+		{
+			if (sharedStates[i->m_arg] != RULEPROGRAMUNKNOWN)
+			{
+				result = sharedStates[i->m_arg];
+				i = code + i->m_arg2 - 1;
+			}
+		}
+		else if (i->m_op == OP_STORESHARED)
+		{
+			sharedStates[i->m_arg] = result;
+		}
+		else
+		{
+			result = i->m_arg;
+		}
+
+		// only the children of and/or jump, and they always save
+		if (i->m_save != SAVE_NONE)
+		{
+			if (result == i->m_jumpIf)
+			{
+				i = code + i->m_target - 1;
+			}
+			else if (i->m_save == SAVE_STORE || result != LogicalExpression::S_IGNORE)
+			{
+				slots[i->m_slot] = result;
+			}
+		}
+	}
+
+	return static_cast<LogicalExpression::STATE>(result);
+}
+
+void RuleProgram::RunBatch(IdObjectWithTags const * const *objects, unsigned num, IndexBitset *trueSet, IndexBitset *falseSet) const
+{
+	for (unsigned i = 0; i < num; i += 64)
+	{
+		wxUint64 t, f;
+		RunWord(objects + i, num - i < 64 ? num - i : 64, &t, &f);
+		trueSet->SetWord(i >> 6, t);
+		falseSet->SetWord(i >> 6, f);
+	}
+}
+
+void RuleProgram::RunWord(IdObjectWithTags const * const *objects, unsigned num, wxUint64 *trueBits, wxUint64 *falseBits) const
+{
+	// per slot the accumulated values, and the objects that got the short circuit value of the and/or.
+	// with Run() those would have jumped to the end
+	wxUint64 slotTrue[RULEPROGRAMMAXSLOTS], slotFalse[RULEPROGRAMMAXSLOTS];
+	wxUint64 decidedTrue[RULEPROGRAMMAXSLOTS], decidedFalse[RULEPROGRAMMAXSLOTS];
+
+	wxUint64 all = num < 64 ? ((wxUint64)1 << num) - 1 : ~(wxUint64)0;
+	wxUint64 t = 0, f = 0; // objects in neither are S_IGNORE
+
+	assert(m_compiled);
+
+	for (Instruction const *i = m_code; i < m_code + m_num; i++)
+	{
+		switch(i->m_op)
+		{
+			case OP_TAG:
+				t = 0;
+				for (unsigned o = 0; o < num; o++)
+				{
+					for (OsmTag const *tag = objects[o]->m_tags; tag; tag = static_cast<OsmTag const *>(tag->m_next))
+					{
+						if (tag->m_index.m_keyIndex == i->m_arg && (!i->m_arg2 || !tag->m_index.m_valueIndex || tag->m_index.m_valueIndex == i->m_arg2))
+						{
+							t |= (wxUint64)1 << o;
+							break;
+						}
+					}
+				}
+				f = all & ~t;
+			break;
+			case OP_VALUE:
+				t = 0;
+				for (unsigned o = 0; o < num; o++)
+				{
+					for (OsmTag const *tag = objects[o]->m_tags; tag; tag = static_cast<OsmTag const *>(tag->m_next))
+					{
+						if (tag->m_index.m_keyIndex == i->m_arg && m_matchers[i->m_arg2]->Matches(tag->m_index.m_valueIndex))
+						{
+							t |= (wxUint64)1 << o;
+							break;
+						}
+					}
+				}
+				f = all & ~t;
+			break;
+			case OP_KIND:
+				t = 0;
+				for (unsigned o = 0; o < num; o++)
+				{
+					if (objects[o]->m_kind == i->m_arg)
+					{
+						t |= (wxUint64)1 << o;
+					}
+				}
+				f = all & ~t;
+			break;
+			case OP_SIZE:
+				t = 0;
+				for (unsigned o = 0; o < num; o++)
+				{
+					if (MinPixels::GetSize(objects[o]) >= m_sizes[i->m_arg])
+					{
+						t |= (wxUint64)1 << o;
+					}
+				}
+				f = all & ~t;
+			break;
+			case OP_CONST:
+				t = i->m_arg == LogicalExpression::S_TRUE ? all : 0;
+				f = i->m_arg == LogicalExpression::S_FALSE ? all : 0;
+			break;
+			case OP_NOT:
+			{
+				wxUint64 swap = t;
+				t = f;
+				f = swap;
+			}
+			break;
+			case OP_LOADIFIGNORE:
+			{
+				wxUint64 ignore = all & ~(t | f);
+				wxUint64 decided = decidedTrue[i->m_arg] | decidedFalse[i->m_arg];
+
+				t = ((t | (ignore & slotTrue[i->m_arg])) & ~decided) | decidedTrue[i->m_arg];
+				f = ((f | (ignore & slotFalse[i->m_arg])) & ~decided) | decidedFalse[i->m_arg];
+			}
+			break;
+			case OP_LOADSHARED:
+			case OP_STORESHARED:
+				// nothing is shared between batches, the code in between is always run
+			break;
+			default:
+				// OP_TEST needs the tag tests of one object
+				assert(0);
+			break;
+		}
+
+		if (i->m_save != SAVE_NONE)
+		{
+			wxUint64 decided = i->m_jumpIf == LogicalExpression::S_TRUE ? t : f;
+			wxUint64 *decidedSet = i->m_jumpIf == LogicalExpression::S_TRUE ? decidedTrue : decidedFalse;
+			wxUint64 *otherSet = i->m_jumpIf == LogicalExpression::S_TRUE ? decidedFalse : decidedTrue;
+			unsigned s = i->m_slot;
+
+			if (i->m_save == SAVE_STORE)
+			{
+				decidedSet[s] = decided;
+				otherSet[s] = 0;
+				slotTrue[s] = t;
+				slotFalse[s] = f;
+			}
+			else
+			{
+				wxUint64 known = t | f;
+
+				decidedSet[s] |= decided;
+				slotTrue[s] = (slotTrue[s] & ~known) | t;
+				slotFalse[s] = (slotFalse[s] & ~known) | f;
+			}
+		}
+	}
+
+	*trueBits = t;
+	*falseBits = f;
+}
+
+void RuleProgram::Dump() const
+{
+	char const *opNames[] = { "tag", "test", "kind", "value", "size", "const", "not", "loadifignore", "loadshared", "storeshared" };
+
+	for (unsigned i = 0; i < m_num; i++)
+	{
+		Instruction const &in = m_code[i];
+		printf("%4u %-12s arg %u %u jumpif %u target %u save %u slot %u\n", i, opNames[in.m_op], in.m_arg, in.m_arg2, in.m_jumpIf, in.m_target, in.m_save, in.m_slot);
+	}
+}
+
 Operators::E_OPERATOR ExpressionParser::MatchOperator(char const *s, int *pos, bool *disabled)
 {
 	char const *operators[] =
 	{
-		"not", "and", "or", "tag", "type"
+		"not", "and", "or", "tag", "type", "<", "<=", ">", ">=", "range", "prefix", "regex", "zoom", "minpixels"
 	};
 
 	if (s[*pos] == '-')
@@ -32,19 +712,67 @@ Operators::E_OPERATOR ExpressionParser::MatchOperator(char const *s, int *pos, b
 		m_mustColorDisabled++;
 	}
 
+	// the longest operator that matches, so "<=" isn't taken for "<"
 	int count = sizeof(operators)/sizeof(char *);
+	int found = count;
+	int foundLen = 0;
 	for (int i = 0; i < count ; i++)
 	{
-		if (!strncasecmp(operators[i], s + *pos, strlen(operators[i])))
+		int len = strlen(operators[i]);
+		if (len > foundLen && !strncasecmp(operators[i], s + *pos, len))
 		{
-			int len = strlen(operators[i]);
-			SetColorD(*pos, *pos + len, RuleDisplay::EC_OPERATOR);
-			*pos += len;
-			return static_cast<Operators::E_OPERATOR>(i);
+			found = i;
+			foundLen = len;
 		}
 	}
 
-	return static_cast<Operators::E_OPERATOR>(count);
+	if (found < count)
+	{
+		SetColorD(*pos, *pos + foundLen, RuleDisplay::EC_OPERATOR);
+		*pos += foundLen;
+	}
+
+	return static_cast<Operators::E_OPERATOR>(found);
+}
+
+bool ExpressionParser::ParseNumber(char const *f, int *pos, double *value, char *logError, unsigned maxLogErrorSize, unsigned *errorPos)
+{
+	EatSpace(f, pos);
+
+	int p = *pos;
+
+	// quoted, like the other arguments, or bare
+	char const *s = f + p;
+	if (f[p] == '"' || f[p] == '\'')
+	{
+		s = ParseString(f, &p, logError, maxLogErrorSize, errorPos);
+		if (!s)
+		{
+			return false;
+		}
+	}
+
+	char *end;
+	*value = strtod(s, &end);
+
+	if (end == s || (s != f + *pos && *end))
+	{
+		snprintf(logError, maxLogErrorSize, "expected number");
+		*errorPos = *pos;
+		return false;
+	}
+
+	if (s == f + *pos)
+	{
+		p = end - f;
+		SetColorD(*pos, p, RuleDisplay::EC_STRING);
+	}
+
+	*pos = p;
+
+	EatSpace(f, pos);
+
+	return true;
 }
 
 
@@ -161,6 +889,7 @@ LogicalExpression *ExpressionParser::ParseSingle(char const *f, int *pos, char *
 	EatSpace(f, pos);
 
 	int p = *pos;
+	int start = p;
 
 	if (!(f[p]))
 	{
@@ -246,6 +975,80 @@ LogicalExpression *ExpressionParser::ParseSingle(char const *f, int *pos, char *
 
 		}
 		break;
+		case Operators::LESS:
+		case Operators::LESSEQUAL:
+		case Operators::GREATER:
+		case Operators::GREATEREQUAL:
+		case Operators::RANGE:
+		{
+			// ParseString() reuses its buffers
+			char key[1024];
+			char const *k = ParseString(f, &p,logError, maxLogErrorSize, errorPos);
+
+			if (!k)
+			{
+				snprintf(logError, maxLogErrorSize, "expected tag key");
+				goto error;
+			}
+			strncpy(key, k, sizeof(key));
+
+			double min = 0, max = 0;
+			if (!ParseNumber(f, &p, &min, logError, maxLogErrorSize, errorPos))
+			{
+				goto error;
+			}
+
+			if (op == Operators::RANGE && !ParseNumber(f, &p, &max, logError, maxLogErrorSize, errorPos))
+			{
+				goto error;
+			}
+
+			ret = new TagValue(static_cast<ValueMatcher::KIND>(ValueMatcher::LESS + (op - Operators::LESS)), key, min, max, NULL);
+		}
+		break;
+		case Operators::PREFIX:
+		case Operators::REGEX:
+		{
+			char const *key = ParseString(f, &p,logError, maxLogErrorSize, errorPos);
+			char const *pattern = key ? ParseString(f, &p,logError, maxLogErrorSize, errorPos) : NULL;
+
+			if (!key || !pattern)
+			{
+				snprintf(logError, maxLogErrorSize, key ? "expected pattern" : "expected tag key");
+				goto error;
+			}
+
+			ret = new TagValue(op == Operators::PREFIX ? ValueMatcher::PREFIX : ValueMatcher::REGEX, key, 0, 0, pattern);
+
+			if (!ret->Valid())
+			{
+				snprintf(logError, maxLogErrorSize, "invalid regular expression");
+				goto error;
+			}
+		}
+		break;
+		case Operators::ZOOM:
+		{
+			double min = 0, max = 0;
+			if (!ParseNumber(f, &p, &min, logError, maxLogErrorSize, errorPos) || !ParseNumber(f, &p, &max, logError, maxLogErrorSize, errorPos))
+			{
+				goto error;
+			}
+
+			ret = new Zoom(min, max);
+		}
+		break;
+		case Operators::MINPIXELS:
+		{
+			double pixels = 0;
+			if (!ParseNumber(f, &p, &pixels, logError, maxLogErrorSize, errorPos))
+			{
+				goto error;
+			}
+
+			ret = new MinPixels(pixels);
+		}
+		break;
 		default:
 			snprintf(logError, maxLogErrorSize, "unknown operator");
 			goto error;
@@ -302,7 +1105,8 @@ LogicalExpression *ExpressionParser::ParseSingle(char const *f, int *pos, char *
 	// clear the errorlog
 	*logError = 0;
 
-	ret->m_disabled = disabled;
+	ret->SetDisabled(disabled);
+	ret->SetSpan(start, p);
 
 	if (disabled)
 	{
@@ -20,6 +20,9 @@
 */
 
 #include "osm.h"
+#include "tagsummary.h"
+#include "tagpostings.h"
+#include "valuematcher.h"
 #include "external-libs/md5/md5.h"
 // an MD5 class geared to comparing LogicalExpression instances
 class ExpressionMD5
@@ -97,6 +100,17 @@ class ExpressionMD5
 			return 0;
 		}
 
+		// the first bytes of the digest, to tell expressions apart in a report
+		wxString ShortHex(unsigned bytes = 4) const
+		{
+			wxString ret;
+			for (unsigned i = 0; i < bytes && i < 16; i++)
+			{
+				ret += wxString::Format(wxT("%02X"), (unsigned char)m_digest[i]);
+			}
+			return ret;
+		}
+
 		void Dump() const
 		{
 			printf("%c%c", m_inited ? 't' : 'f' ,m_finished ? 't' : 'f');
@@ -120,8 +134,72 @@ class ExpressionMD5
 };
 
 class LogicalExpression;
+class RuleProgram;
+class RuleTagTests;
+class RuleSharedExpressions;
+
+// sets of LogicalExpression::STATE values, for GetPossibleStates()
+#define STATEBIT(s) (1u << (s))
 
 WX_DEFINE_ARRAY_PTR(LogicalExpression *, LogicalExpressionArray);
+WX_DEFINE_ARRAY_PTR(ValueMatcher *, ValueMatcherArray);
+
+// what evaluating one expression cost, collected while the rules are profiled. the
+// time includes the children
+class ExpressionProfile
+{
+	public:
+		ExpressionProfile()
+		{
+			Clear();
+		}
+
+		void Clear()
+		{
+			m_calls = 0;
+			m_states[0] = m_states[1] = m_states[2] = 0;
+			m_nanoseconds = 0;
+		}
+
+		unsigned m_calls;
+		unsigned m_states[3]; // per LogicalExpression::STATE
+		wxUint64 m_nanoseconds;
+};
+
+// the scale the rules are drawn at, for (zoom) and (minpixels). unknown until a render job sets it
+class RuleScale
+{
+	public:
+		RuleScale(double unitsPerPixel = 0)
+		{
+			m_unitsPerPixel = unitsPerPixel;
+		}
+
+		bool IsKnown() const
+		{
+			return m_unitsPerPixel > 0;
+		}
+
+		// in projected coordinates
+		double GetUnitsPerPixel() const
+		{
+			return m_unitsPerPixel;
+		}
+
+		// the zoom level of web maps: the world is 256 pixels wide at zoom 0, and every level doubles that
+		double GetZoom() const
+		{
+			return log(2.0 * PROJECTIONRESOLUTION / (256.0 * m_unitsPerPixel)) / log(2.0);
+		}
+
+		bool operator==(RuleScale const &other) const
+		{
+			return m_unitsPerPixel == other.m_unitsPerPixel;
+		}
+
+	private:
+		double m_unitsPerPixel;
+};
 
 class LogicalExpression
 {
@@ -129,6 +207,8 @@ class LogicalExpression
 		LogicalExpression()
 		{
 			m_disabled = false;
+			m_md5Valid = false;
+			m_spanStart = m_spanEnd = 0;
 		}
 		virtual ~LogicalExpression()
 		{
@@ -148,11 +228,19 @@ class LogicalExpression
 		void AddChild(LogicalExpression *c)
 		{
 			m_children.Add(c);
+			m_md5Valid = false;
 		}
 
 		void ClearChildren()
 		{
 			WX_CLEAR_ARRAY(m_children);
+			m_md5Valid = false;
+		}
+
+		void SetDisabled(bool disabled)
+		{
+			m_disabled = disabled;
+			m_md5Valid = false;
 		}
 
 		unsigned GetNumChildren()
@@ -161,16 +249,74 @@ class LogicalExpression
 		}
 
 		LogicalExpressionArray m_children;
-		virtual STATE GetValue(IdObjectWithTags *o) = 0;
+		virtual STATE GetValue(IdObjectWithTags *o, bool profiling) = 0;
 		virtual void Reorder() = 0;
 
+		// a copy of the expression and all below it, as they are now, without the profile
+		virtual LogicalExpression *Clone() const = 0;
+
+		// evaluates the parts that depend on the scale for this one, and recalculates the MD5s of
+		// the expressions that changed. returns true if any did
+		virtual bool SetScale(RuleScale const &scale);
+
+		// GetValue(), also counted in m_profile when profiling. the children are evaluated through
+		// this too
+		STATE Value(IdObjectWithTags *o, bool profiling)
+		{
+			return profiling ? ProfiledValue(o) : GetValue(o, false);
+		}
+
+		// whether the rules are profiled, as the menu sets it. a render job reads it when it starts and
+		// passes it on to the evaluation: profiled rules are evaluated by walking the tree, and every
+		// expression counts its calls, values and time. slows evaluation down a lot
+		static bool s_profiling;
+		ExpressionProfile m_profile;
+
+		// builds the tables of the value tests in it, see ValueMatcher::Build(). returns true if a
+		// matcher was replaced, a program compiled from it has to be compiled again then
+		virtual bool BuildTables();
+
+		// of this expression and all below it
+		void ClearProfile();
+
+		// appends a line per expression to text: its MD5, its text from source, which is what was
+		// parsed, and its profile. children are indented below their parent
+		void ProfileText(wxString *text, char const *source, int indent = 0) const;
+
+		// where the expression is in the parsed text, in bytes
+		void SetSpan(int start, int end)
+		{
+			m_spanStart = start;
+			m_spanEnd = end;
+		}
+
+		// the STATEBITs of the values GetValue() could return for the objects summary describes. may
+		// contain states that don't occur, never misses one that does
+		virtual unsigned GetPossibleStates(TagSummary const &summary) const = 0;
+
+		// evaluates the expression for all objects of one kind at once, with set operations on the
+		// posting lists. sets the bits of the objects for which GetValue() would be S_TRUE in trueSet,
+		// and of those for which it would be S_FALSE in falseSet. both must be cleared, and sized to
+		// postings.GetNumObjects()
+		virtual void Select(TagPostings const &postings, IdObject::KIND kind, IndexBitset *trueSet, IndexBitset *falseSet) const = 0;
+
+		// appends code that leaves GetValue() in the result register. slot is the first accumulator
+		// slot this expression may use, see RuleProgram
+		virtual void Compile(RuleProgram *program, unsigned slot) const = 0;
+
+		// calculated on first use. an expression only changes while it is being built, bottom up,
+		// so a change to the children has to happen before the parent's MD5 is used
 		ExpressionMD5 const &MD5() const
 		{
-			m_md5.Init();
-			char flags = m_disabled ? 1 : 0;
-			m_md5.Add(&flags, sizeof(flags));
-			CalcMD5();
-			m_md5.Finish();
+			if (!m_md5Valid)
+			{
+				m_md5.Init();
+				char flags = m_disabled ? 1 : 0;
+				m_md5.Add(&flags, sizeof(flags));
+				CalcMD5();
+				m_md5.Finish();
+				m_md5Valid = true;
+			}
 			return m_md5;
 		}
 		bool m_disabled;
@@ -179,12 +325,163 @@ class LogicalExpression
 	protected:
 		virtual void CalcMD5() const = 0;
 		mutable ExpressionMD5 m_md5;
+		mutable bool m_md5Valid;
+
+		int m_spanStart, m_spanEnd;
+
+		STATE ProfiledValue(IdObjectWithTags *o);
+
+		// for Clone(): copies what every expression has to to, and adds clones of the children
+		void CloneInto(LogicalExpression *to) const;
 
 };
 
 
 int CompareLogicalExpressionPtrs(LogicalExpression **p1, LogicalExpression **p2);
 
+// the number of nested and/or expressions a RuleProgram can hold
+#define RULEPROGRAMMAXSLOTS 32
+// RuleProgram jump condition of instructions that don't jump. isn't a STATE, so never matches the result
+#define RULEPROGRAMNOJUMP 0xFF
+// the value of a shared expression that hasn't been evaluated yet for the current object
+#define RULEPROGRAMUNKNOWN 0xFF
+
+// a LogicalExpression flattened into a list of instructions, to evaluate rules without walking the tree.
+// every instruction sets a result register, which holds a LogicalExpression::STATE, and can then jump
+// on it or save it in an accumulator slot, one slot per nesting level of and/or. and/or jump to their
+// end as soon as a child gives the value that decides them, disabled expressions are compiled to
+// constants and disabled children are left out
+class RuleProgram
+{
+	public:
+		RuleProgram();
+		~RuleProgram();
+
+		// returns false if the expression nests too deep, IsCompiled() is false then. with tests, the
+		// tag tests are added to them instead of compiled in, and Run() needs their results. with
+		// shared, the value of a subexpression that is in it is stored the first time it is
+		// evaluated, and looked up after that
+		bool Compile(LogicalExpression const *expr, RuleTagTests *tests = NULL, RuleSharedExpressions const *shared = NULL);
+		void Clear();
+
+		// the same program, for a clone of the expression other was compiled from. the value matchers
+		// are shared with the clone
+		void CopyFrom(RuleProgram const &other);
+
+		bool IsCompiled() const
+		{
+			return m_compiled;
+		}
+
+		// the same value as expr->GetValue(o) for the expression that was compiled. testBits are the
+		// results of RuleTagTests::Run() for o, if the program was compiled with tests. sharedStates
+		// are the values of the shared expressions for o, if it was compiled with shared ones; set
+		// them to RULEPROGRAMUNKNOWN for every new object, programs compiled with the same shared
+		// expressions fill them in
+		LogicalExpression::STATE Run(IdObjectWithTags const *o, wxUint64 const *testBits = NULL, unsigned char *sharedStates = NULL) const;
+
+		// Run() for num objects at once, for a program compiled without tests. sets bit i of trueSet
+		// if the value for objects[i] is S_TRUE, and of falseSet if it is S_FALSE. both are
+		// overwritten, and must be sized to num. the instructions work on 64 objects at a time, with
+		// a bit mask per value, and run straight through: and/or combine the masks of all children
+		// instead of jumping
+		void RunBatch(IdObjectWithTags const * const *objects, unsigned num, IndexBitset *trueSet, IndexBitset *falseSet) const;
+
+		unsigned GetNumInstructions() const
+		{
+			return m_num;
+		}
+
+		// for programs compiled with tests: the tag tests of which at least one is true when Run() is
+		// S_TRUE, unless CanBeTrueWithoutTriggers()
+		wxArrayInt const &GetTriggers() const
+		{
+			return m_triggers;
+		}
+
+		bool CanBeTrueWithoutTriggers() const
+		{
+			return m_anyTrigger;
+		}
+
+		bool CanBeIgnore() const
+		{
+			return m_canIgnore;
+		}
+
+		void Dump() const;
+
+		// used by LogicalExpression::Compile()
+		void CompileChild(LogicalExpression const *child, unsigned slot);
+		void EmitTag(TagIndex const &index);
+		void EmitValue(ValueMatcher *matcher);
+		void EmitKind(IdObject::KIND kind);
+		void EmitSize(double minSize);
+		void EmitConst(LogicalExpression::STATE s);
+		void EmitNot();
+
+		// and (shortCircuit S_FALSE) or or (shortCircuit S_TRUE) of the enabled children
+		void EmitCombine(LogicalExpressionArray const &children, LogicalExpression::STATE shortCircuit, unsigned slot);
+
+	private:
+		RuleProgram(RuleProgram const &other);
+		RuleProgram const &operator=(RuleProgram const &other);
+
+		enum OPCODE
+		{
+			OP_TAG,         // S_TRUE if the object has tag (m_arg, m_arg2), else S_FALSE
+			OP_TEST,        // S_TRUE if bit m_arg of the tag test results is set, else S_FALSE
+			OP_KIND,        // S_TRUE if the object is of kind m_arg, else S_FALSE
+			OP_VALUE,       // S_TRUE if the object has a tag with key m_arg that value matcher m_arg2 matches
+			OP_SIZE,        // S_TRUE if the object is at least m_sizes[m_arg] wide or high, see MinPixels
+			OP_CONST,       // m_arg
+			OP_NOT,         // swaps S_TRUE and S_FALSE in the result
+			OP_LOADIFIGNORE, // slot m_arg, if the result is S_IGNORE
+			OP_LOADSHARED,   // shared value m_arg, and jumps to m_arg2, if it is known
+			OP_STORESHARED   // stores the result as shared value m_arg
+		};
+
+		enum SAVE
+		{
+			SAVE_NONE,
+			SAVE_STORE,     // slot m_slot = result
+			SAVE_ACCUMULATE // slot m_slot = result, unless the result is S_IGNORE
+		};
+
+		// after the opcode has set the result, jumps to m_target if the result is m_jumpIf, and
+		// otherwise saves it as m_save says
+		class Instruction
+		{
+			public:
+				unsigned char m_op;
+				unsigned char m_jumpIf;
+				unsigned char m_save;
+				unsigned char m_slot;
+				unsigned m_target;
+				unsigned m_arg;
+				unsigned m_arg2;
+		};
+
+		Instruction *Emit(OPCODE op);
+
+		// RunBatch() for up to 64 objects
+		void RunWord(IdObjectWithTags const * const *objects, unsigned num, wxUint64 *trueBits, wxUint64 *falseBits) const;
+
+		Instruction *m_code;
+		unsigned m_num;
+		unsigned m_max;
+		bool m_compiled;
+		RuleTagTests *m_tests; // only while compiling
+		RuleSharedExpressions const *m_shared; // only while compiling
+		ValueMatcherArray m_matchers;          // of the expression, not owned
+		wxArrayDouble m_sizes;                 // for OP_SIZE
+
+		// about the expression compiled last, see GetTriggers()
+		wxArrayInt m_triggers;
+		bool m_anyTrigger;
+		bool m_canIgnore;
+};
+
 
 class Operators
 {
@@ -196,6 +493,15 @@ public:
 		OR,
 		TAG,
 		TYPE,
+		LESS,
+		LESSEQUAL,
+		GREATER,
+		GREATEREQUAL,
+		RANGE,
+		PREFIX,
+		REGEX,
+		ZOOM,
+		MINPIXELS,
 		OFF,
 		INVALID
 	};
@@ -258,7 +564,14 @@ class Type
 		{
 			m_type = type;
 		}
-		virtual STATE GetValue(IdObjectWithTags *o)
+
+		LogicalExpression *Clone() const
+		{
+			Type *ret = new Type(m_type);
+			CloneInto(ret);
+			return ret;
+		}
+		virtual STATE GetValue(IdObjectWithTags *o, bool profiling)
 		{
 			if (m_disabled)
 				return S_IGNORE;
@@ -266,13 +579,13 @@ class Type
 			switch(m_type)
 			{
 				case NODE:
-					return dynamic_cast<OsmNode *>(o) == NULL ? S_FALSE : S_TRUE;
+					return o->IsNode() ? S_TRUE : S_FALSE;
 				break;
 				case RELATION:
-					return dynamic_cast<OsmRelation *>(o) == NULL ? S_FALSE : S_TRUE;
+					return o->IsRelation() ? S_TRUE : S_FALSE;
 				break;
 				case WAY:
-					return ((dynamic_cast<OsmWay *>(o) != NULL)  && (dynamic_cast<OsmRelation *>(o) == NULL)) ? S_TRUE : S_FALSE;
+					return o->IsWay() ? S_TRUE : S_FALSE;
 				break;
 				case INVALID:
 					return S_IGNORE;
@@ -282,6 +595,60 @@ class Type
 			return S_IGNORE;
 		}
 
+		unsigned GetPossibleStates(TagSummary const &summary) const
+		{
+			IdObject::KIND kinds[] = { IdObject::NODE, IdObject::WAY, IdObject::RELATION };
+
+			if (m_disabled || m_type == INVALID)
+			{
+				return STATEBIT(S_IGNORE);
+			}
+
+			unsigned ret = 0;
+			if (summary.MayHaveKind(kinds[m_type]))
+			{
+				ret |= STATEBIT(S_TRUE);
+			}
+			if (summary.MayHaveOtherThan(kinds[m_type]))
+			{
+				ret |= STATEBIT(S_FALSE);
+			}
+
+			return ret;
+		}
+
+		void Select(TagPostings const &postings, IdObject::KIND kind, IndexBitset *trueSet, IndexBitset *falseSet) const
+		{
+			IdObject::KIND kinds[] = { IdObject::NODE, IdObject::WAY, IdObject::RELATION };
+
+			if (m_disabled || m_type == INVALID)
+			{
+				return;
+			}
+
+			if (kinds[m_type] == kind)
+			{
+				trueSet->SetAll();
+			}
+			else
+			{
+				falseSet->SetAll();
+			}
+		}
+
+		void Compile(RuleProgram *program, unsigned slot) const
+		{
+			IdObject::KIND kinds[] = { IdObject::NODE, IdObject::WAY, IdObject::RELATION };
+
+			if (m_disabled || m_type == INVALID)
+			{
+				program->EmitConst(S_IGNORE);
+				return;
+			}
+
+			program->EmitKind(kinds[m_type]);
+		}
+
 	protected:
 		void CalcMD5() const
 		{
@@ -298,17 +665,58 @@ class Not
 	: public LogicalExpression
 {
 	public:
-		virtual STATE GetValue(IdObjectWithTags *o)
+		LogicalExpression *Clone() const
+		{
+			Not *ret = new Not;
+			CloneInto(ret);
+			return ret;
+		}
+
+		virtual STATE GetValue(IdObjectWithTags *o, bool profiling)
 		{
 			if (m_disabled)
 				return S_IGNORE;
 
 			STATE states[] = {  S_TRUE, S_FALSE, S_IGNORE};
-			STATE s = m_children[0]->GetValue(o);
+			STATE s = m_children[0]->Value(o, profiling);
 
 			return states[s];
 		}
 
+		unsigned GetPossibleStates(TagSummary const &summary) const
+		{
+			if (m_disabled)
+			{
+				return STATEBIT(S_IGNORE);
+			}
+
+			unsigned s = m_children[0]->GetPossibleStates(summary);
+
+			return (s & STATEBIT(S_IGNORE)) | ((s & STATEBIT(S_TRUE)) ? STATEBIT(S_FALSE) : 0) | ((s & STATEBIT(S_FALSE)) ? STATEBIT(S_TRUE) : 0);
+		}
+
+		void Select(TagPostings const &postings, IdObject::KIND kind, IndexBitset *trueSet, IndexBitset *falseSet) const
+		{
+			if (m_disabled)
+			{
+				return;
+			}
+
+			m_children[0]->Select(postings, kind, falseSet, trueSet);
+		}
+
+		void Compile(RuleProgram *program, unsigned slot) const
+		{
+			if (m_disabled)
+			{
+				program->EmitConst(S_IGNORE);
+				return;
+			}
+
+			program->CompileChild(m_children[0], slot);
+			program->EmitNot();
+		}
+
 		void Dump(int indent) const
 		{
 			for (int i = 0; i < indent; i++)
@@ -349,7 +757,14 @@ class And
 	: public LogicalExpression
 {
 	public:
-		STATE GetValue(IdObjectWithTags *o)
+		LogicalExpression *Clone() const
+		{
+			And *ret = new And;
+			CloneInto(ret);
+			return ret;
+		}
+
+		STATE GetValue(IdObjectWithTags *o, bool profiling)
 		{
 			if (m_disabled)
 				return S_IGNORE;
@@ -359,7 +774,7 @@ class And
 			{
 				if (!m_children[i]->m_disabled)
 				{
-					STATE s = m_children[i]->GetValue(o);
+					STATE s = m_children[i]->Value(o, profiling);
 					if (s == S_FALSE)
 						return S_FALSE;
 					else if (s == S_TRUE)
@@ -372,6 +787,66 @@ class And
 			return trueCount ? S_TRUE : S_IGNORE;
 		}
 
+		// the children are analysed independently, as if they were about different objects, which can
+		// only add states
+		unsigned GetPossibleStates(TagSummary const &summary) const
+		{
+			if (m_disabled)
+			{
+				return STATEBIT(S_IGNORE);
+			}
+
+			bool anyFalse = false, anyTrue = false, allNotFalse = true, allIgnore = true;
+			for (unsigned i = 0; i < m_children.GetCount(); i++)
+			{
+				if (!m_children[i]->m_disabled)
+				{
+					unsigned s = m_children[i]->GetPossibleStates(summary);
+					anyFalse |= (s & STATEBIT(S_FALSE)) != 0;
+					anyTrue |= (s & STATEBIT(S_TRUE)) != 0;
+					allNotFalse &= (s & (STATEBIT(S_TRUE) | STATEBIT(S_IGNORE))) != 0;
+					allIgnore &= (s & STATEBIT(S_IGNORE)) != 0;
+				}
+			}
+
+			return (anyFalse ? STATEBIT(S_FALSE) : 0) | (allNotFalse && anyTrue ? STATEBIT(S_TRUE) : 0) | (allIgnore ? STATEBIT(S_IGNORE) : 0);
+		}
+
+		// false where any child is false, true where any child is true and none is false
+		void Select(TagPostings const &postings, IdObject::KIND kind, IndexBitset *trueSet, IndexBitset *falseSet) const
+		{
+			if (m_disabled)
+			{
+				return;
+			}
+
+			IndexBitset t(postings.GetNumObjects()), f(postings.GetNumObjects());
+			for (unsigned i = 0; i < m_children.GetCount(); i++)
+			{
+				if (!m_children[i]->m_disabled)
+				{
+					t.Clear();
+					f.Clear();
+					m_children[i]->Select(postings, kind, &t, &f);
+					trueSet->Or(t);
+					falseSet->Or(f);
+				}
+			}
+
+			trueSet->AndNot(*falseSet);
+		}
+
+		void Compile(RuleProgram *program, unsigned slot) const
+		{
+			if (m_disabled)
+			{
+				program->EmitConst(S_IGNORE);
+				return;
+			}
+
+			program->EmitCombine(m_children, S_FALSE, slot);
+		}
+
 		void Dump(int indent) const
 		{
 			for (int i = 0; i < indent; i++)
@@ -414,6 +889,7 @@ class And
 
 			// now that all children are in a standardized form, reorder the children
 			m_children.Sort(CompareLogicalExpressionPtrs);
+			m_md5Valid = false;
 		}
 
 		void CalcMD5() const
@@ -433,7 +909,14 @@ class Or
 	: public LogicalExpression
 {
 	public:
-		STATE GetValue(IdObjectWithTags *o)
+		LogicalExpression *Clone() const
+		{
+			Or *ret = new Or;
+			CloneInto(ret);
+			return ret;
+		}
+
+		STATE GetValue(IdObjectWithTags *o, bool profiling)
 		{
 			if (m_disabled)
 				return S_IGNORE;
@@ -443,7 +926,7 @@ class Or
 			{
 				if ( !m_children[i]->m_disabled)
 				{
-					STATE s = m_children[i]->GetValue(o);
+					STATE s = m_children[i]->Value(o, profiling);
 
 					switch(s)
 					{
@@ -462,6 +945,65 @@ class Or
 			return falseCount ? S_FALSE : S_IGNORE;
 		}
 
+		// see And::GetPossibleStates()
+		unsigned GetPossibleStates(TagSummary const &summary) const
+		{
+			if (m_disabled)
+			{
+				return STATEBIT(S_IGNORE);
+			}
+
+			bool anyTrue = false, anyFalse = false, allNotTrue = true, allIgnore = true;
+			for (unsigned i = 0; i < m_children.GetCount(); i++)
+			{
+				if (!m_children[i]->m_disabled)
+				{
+					unsigned s = m_children[i]->GetPossibleStates(summary);
+					anyTrue |= (s & STATEBIT(S_TRUE)) != 0;
+					anyFalse |= (s & STATEBIT(S_FALSE)) != 0;
+					allNotTrue &= (s & (STATEBIT(S_FALSE) | STATEBIT(S_IGNORE))) != 0;
+					allIgnore &= (s & STATEBIT(S_IGNORE)) != 0;
+				}
+			}
+
+			return (anyTrue ? STATEBIT(S_TRUE) : 0) | (allNotTrue && anyFalse ? STATEBIT(S_FALSE) : 0) | (allIgnore ? STATEBIT(S_IGNORE) : 0);
+		}
+
+		// true where any child is true, false where any child is false and none is true
+		void Select(TagPostings const &postings, IdObject::KIND kind, IndexBitset *trueSet, IndexBitset *falseSet) const
+		{
+			if (m_disabled)
+			{
+				return;
+			}
+
+			IndexBitset t(postings.GetNumObjects()), f(postings.GetNumObjects());
+			for (unsigned i = 0; i < m_children.GetCount(); i++)
+			{
+				if (!m_children[i]->m_disabled)
+				{
+					t.Clear();
+					f.Clear();
+					m_children[i]->Select(postings, kind, &t, &f);
+					trueSet->Or(t);
+					falseSet->Or(f);
+				}
+			}
+
+			falseSet->AndNot(*trueSet);
+		}
+
+		void Compile(RuleProgram *program, unsigned slot) const
+		{
+			if (m_disabled)
+			{
+				program->EmitConst(S_IGNORE);
+				return;
+			}
+
+			program->EmitCombine(m_children, S_TRUE, slot);
+		}
+
 		bool Valid() const
 		{
 			for (unsigned i = 0; i < m_children.GetCount(); i++)
@@ -504,6 +1046,7 @@ class Or
 
 			// now that all children are in a standardized form, reorder the children
 			m_children.Sort(CompareLogicalExpressionPtrs);
+			m_md5Valid = false;
 		}
 
 		void CalcMD5() const
@@ -533,6 +1076,13 @@ class Tag
 			delete m_tag;
 		}
 
+		LogicalExpression *Clone() const
+		{
+			Tag *ret = new Tag(*m_tag);
+			CloneInto(ret);
+			return ret;
+		}
+
 
 		void Dump(int indent) const
 		{
@@ -557,27 +1107,436 @@ class Tag
 			return m_tag->GetKey();
 		}
 
-		STATE GetValue(IdObjectWithTags *o)
+		STATE GetValue(IdObjectWithTags *o, bool profiling)
 		{
 			if (m_disabled)
 				return S_IGNORE;
 			return o->HasTag(*m_tag) ? S_TRUE : S_FALSE;
 		}
 
-		void CalcMD5() const
+		unsigned GetPossibleStates(TagSummary const &summary) const
 		{
-			int op = (int)(Operators::TAG);
-			m_md5.Add(&op, sizeof(op));
-			TagIndex index = m_tag->Index();
-			m_md5.Add(&(index.m_keyIndex), sizeof(index.m_keyIndex));
-			m_md5.Add(&(index.m_valueIndex), sizeof(index.m_valueIndex));
+			if (m_disabled)
+			{
+				return STATEBIT(S_IGNORE);
+			}
+
+			// a tag that isn't in the store can't be on any object
+			if (m_tag->Valid() && summary.MayHave(m_tag->m_index))
+			{
+				return STATEBIT(S_TRUE) | STATEBIT(S_FALSE);
+			}
+
+			return STATEBIT(S_FALSE);
+		}
+
+		void Select(TagPostings const &postings, IdObject::KIND kind, IndexBitset *trueSet, IndexBitset *falseSet) const
+		{
+			if (m_disabled)
+			{
+				return;
+			}
+
+			if (m_tag->Valid())
+			{
+				postings.Select(m_tag->m_index, trueSet);
+			}
+
+			falseSet->SetAll();
+			falseSet->AndNot(*trueSet);
+		}
+
+		void Compile(RuleProgram *program, unsigned slot) const
+		{
+			if (m_disabled)
+			{
+				program->EmitConst(S_IGNORE);
+				return;
+			}
+
+			program->EmitTag(m_tag->m_index);
+		}
+
+		void CalcMD5() const
+		{
+			int op = (int)(Operators::TAG);
+			m_md5.Add(&op, sizeof(op));
+			TagIndex index = m_tag->Index();
+			m_md5.Add(&(index.m_keyIndex), sizeof(index.m_keyIndex));
+			m_md5.Add(&(index.m_valueIndex), sizeof(index.m_valueIndex));
 		}
 
 	private:
+		Tag(OsmTag const &tag)
+		{
+			m_tag = new OsmTag(tag);
+		}
+
 		OsmTag *m_tag;
 
 };
 
+// a test of the value of a tag, see ValueMatcher
+class TagValue
+	: public LogicalExpression
+{
+	public:
+		TagValue(ValueMatcher::KIND kind, char const *key, double min, double max, char const *pattern)
+		{
+			m_matcher = ValueMatcher::Get(kind, key, min, max, pattern);
+		}
+
+		~TagValue()
+		{
+			m_matcher->UnRef();
+		}
+
+		// shares the matcher
+		LogicalExpression *Clone() const
+		{
+			TagValue *ret = new TagValue(m_matcher);
+			CloneInto(ret);
+			return ret;
+		}
+
+		bool BuildTables()
+		{
+			ValueMatcher *matcher = m_matcher->Build();
+			bool ret = matcher != m_matcher;
+			m_matcher = matcher;
+			return ret;
+		}
+
+		void Dump(int indent) const
+		{
+			for (int i = 0; i < indent; i++)
+				printf(" ");
+			m_md5.Dump();
+			printf(" (value %d %u %g %g \"%s\")\n", m_matcher->GetKind(), m_matcher->GetKey().m_keyIndex, m_matcher->GetMin(), m_matcher->GetMax(), m_matcher->GetPattern());
+		}
+
+		// false for a regular expression that doesn't compile
+		bool Valid() const
+		{
+			return m_matcher->IsOk();
+		}
+
+		void Reorder()
+		{
+			// nothing to do
+		}
+
+		STATE GetValue(IdObjectWithTags *o, bool profiling)
+		{
+			if (m_disabled)
+				return S_IGNORE;
+
+			for (OsmTag const *t = o->m_tags; t; t = static_cast<OsmTag const *>(t->m_next))
+			{
+				if (m_matcher->Matches(t->m_index))
+				{
+					return S_TRUE;
+				}
+			}
+
+			return S_FALSE;
+		}
+
+		// only objects with the key can match
+		unsigned GetPossibleStates(TagSummary const &summary) const
+		{
+			if (m_disabled)
+			{
+				return STATEBIT(S_IGNORE);
+			}
+
+			TagIndex key = m_matcher->GetKey();
+			if (key.Valid() && summary.MayHave(key))
+			{
+				return STATEBIT(S_TRUE) | STATEBIT(S_FALSE);
+			}
+
+			return STATEBIT(S_FALSE);
+		}
+
+		// the union of the posting lists of the values that match
+		void Select(TagPostings const &postings, IdObject::KIND kind, IndexBitset *trueSet, IndexBitset *falseSet) const
+		{
+			if (m_disabled)
+			{
+				return;
+			}
+
+			TagIndex key = m_matcher->GetKey();
+			if (key.Valid())
+			{
+				unsigned num = OsmTag::m_tagStore->GetNumValues(key.m_keyIndex);
+				for (unsigned v = 1; v <= num; v++)
+				{
+					if (m_matcher->Matches(v))
+					{
+						postings.Select(TagIndex::Create(key.m_keyIndex, v), trueSet);
+					}
+				}
+			}
+
+			falseSet->SetAll();
+			falseSet->AndNot(*trueSet);
+		}
+
+		void Compile(RuleProgram *program, unsigned slot) const
+		{
+			if (m_disabled)
+			{
+				program->EmitConst(S_IGNORE);
+				return;
+			}
+
+			program->EmitValue(m_matcher);
+		}
+
+		void CalcMD5() const
+		{
+			int op = (int)(Operators::LESS) + m_matcher->GetKind();
+			m_md5.Add(&op, sizeof(op));
+			unsigned key = m_matcher->GetKey().m_keyIndex;
+			m_md5.Add(&key, sizeof(key));
+			double min = m_matcher->GetMin(), max = m_matcher->GetMax();
+			m_md5.Add(&min, sizeof(min));
+			m_md5.Add(&max, sizeof(max));
+			m_md5.Add(m_matcher->GetPattern(), strlen(m_matcher->GetPattern()));
+		}
+
+	private:
+		TagValue(ValueMatcher *matcher)
+		{
+			m_matcher = matcher;
+			m_matcher->Ref();
+		}
+
+		ValueMatcher *m_matcher;
+};
+
+// S_TRUE when drawn at a zoom level from m_min up to and including m_max, see RuleScale. it is the
+// same for every object, so it is worked out once per scale, and a program compiles it to a constant,
+// which drops the and/or that it decides
+class Zoom
+	: public LogicalExpression
+{
+	public:
+		Zoom(double min, double max)
+		{
+			m_min = min;
+			m_max = max;
+			m_state = S_IGNORE;
+		}
+
+		LogicalExpression *Clone() const
+		{
+			Zoom *ret = new Zoom(m_min, m_max);
+			ret->m_state = m_state;
+			CloneInto(ret);
+			return ret;
+		}
+
+		void Dump(int indent) const
+		{
+			for (int i = 0; i < indent; i++)
+				printf(" ");
+			m_md5.Dump();
+			printf(" (zoom %g %g) %d\n", m_min, m_max, m_state);
+		}
+
+		bool Valid() const
+		{
+			return true;
+		}
+
+		void Reorder()
+		{
+			// nothing to do
+		}
+
+		// S_IGNORE while the scale is unknown
+		bool SetScale(RuleScale const &scale)
+		{
+			STATE s = S_IGNORE;
+			if (scale.IsKnown())
+			{
+				double zoom = scale.GetZoom();
+				s = zoom >= m_min && zoom <= m_max ? S_TRUE : S_FALSE;
+			}
+
+			if (s == m_state)
+			{
+				return false;
+			}
+
+			m_state = s;
+			m_md5Valid = false;
+			return true;
+		}
+
+		STATE GetValue(IdObjectWithTags *o, bool profiling)
+		{
+			if (m_disabled)
+				return S_IGNORE;
+
+			return m_state;
+		}
+
+		unsigned GetPossibleStates(TagSummary const &summary) const
+		{
+			if (m_disabled)
+			{
+				return STATEBIT(S_IGNORE);
+			}
+
+			return STATEBIT(m_state);
+		}
+
+		void Select(TagPostings const &postings, IdObject::KIND kind, IndexBitset *trueSet, IndexBitset *falseSet) const
+		{
+			if (m_disabled || m_state == S_IGNORE)
+			{
+				return;
+			}
+
+			if (m_state == S_TRUE)
+			{
+				trueSet->SetAll();
+			}
+			else
+			{
+				falseSet->SetAll();
+			}
+		}
+
+		void Compile(RuleProgram *program, unsigned slot) const
+		{
+			program->EmitConst(m_disabled ? S_IGNORE : m_state);
+		}
+
+		// the value is part of it, so results for one zoom level aren't used for another
+		void CalcMD5() const
+		{
+			int op = (int)(Operators::ZOOM);
+			m_md5.Add(&op, sizeof(op));
+			m_md5.Add(&m_min, sizeof(m_min));
+			m_md5.Add(&m_max, sizeof(m_max));
+			m_md5.Add(&m_state, sizeof(m_state));
+		}
+
+	private:
+		double m_min, m_max;
+		STATE m_state;
+};
+
+// S_TRUE for objects of which the bounding box is at least m_pixels wide or high when drawn, see
+// RuleScale. nodes are never that big, unless m_pixels is 0
+class MinPixels
+	: public LogicalExpression
+{
+	public:
+		MinPixels(double pixels)
+		{
+			m_pixels = pixels;
+			m_minSize = -1;
+		}
+
+		LogicalExpression *Clone() const
+		{
+			MinPixels *ret = new MinPixels(m_pixels);
+			ret->m_minSize = m_minSize;
+			CloneInto(ret);
+			return ret;
+		}
+
+		void Dump(int indent) const
+		{
+			for (int i = 0; i < indent; i++)
+				printf(" ");
+			m_md5.Dump();
+			printf(" (minpixels %g) %g\n", m_pixels, m_minSize);
+		}
+
+		bool Valid() const
+		{
+			return true;
+		}
+
+		void Reorder()
+		{
+			// nothing to do
+		}
+
+		// the larger side of the bounding box of o, in projected coordinates
+		static double GetSize(IdObjectWithTags const *o);
+
+		// S_IGNORE while the scale is unknown
+		bool SetScale(RuleScale const &scale)
+		{
+			double size = scale.IsKnown() ? m_pixels * scale.GetUnitsPerPixel() : -1;
+
+			if (size == m_minSize)
+			{
+				return false;
+			}
+
+			m_minSize = size;
+			m_md5Valid = false;
+			return true;
+		}
+
+		STATE GetValue(IdObjectWithTags *o, bool profiling)
+		{
+			if (m_disabled || m_minSize < 0)
+				return S_IGNORE;
+
+			return GetSize(o) >= m_minSize ? S_TRUE : S_FALSE;
+		}
+
+		unsigned GetPossibleStates(TagSummary const &summary) const
+		{
+			if (m_disabled || m_minSize < 0)
+			{
+				return STATEBIT(S_IGNORE);
+			}
+
+			return STATEBIT(S_TRUE) | STATEBIT(S_FALSE);
+		}
+
+		// the posting lists know nothing about sizes, so this counts as S_IGNORE for all objects here
+		void Select(TagPostings const &postings, IdObject::KIND kind, IndexBitset *trueSet, IndexBitset *falseSet) const
+		{
+		}
+
+		void Compile(RuleProgram *program, unsigned slot) const
+		{
+			if (m_disabled || m_minSize < 0)
+			{
+				program->EmitConst(S_IGNORE);
+				return;
+			}
+
+			program->EmitSize(m_minSize);
+		}
+
+		// the size in projected coordinates is part of it, so results for one scale aren't used for
+		// another
+		void CalcMD5() const
+		{
+			int op = (int)(Operators::MINPIXELS);
+			m_md5.Add(&op, sizeof(op));
+			m_md5.Add(&m_pixels, sizeof(m_pixels));
+			m_md5.Add(&m_minSize, sizeof(m_minSize));
+		}
+
+	private:
+		double m_pixels;
+		double m_minSize; // m_pixels at the current scale, -1 while that is unknown
+};
+
 class RuleDisplay
 {
 	public:
@@ -617,6 +1576,9 @@ class ExpressionParser
 		Operators::E_OPERATOR MatchOperator(char const *s, int *pos, bool *disabled);
 		
 		char *ParseString(char const *f, int *pos, char *logError, unsigned maxLogErrorSize, unsigned *errorPos);
+
+		// a number, quoted or not
+		bool ParseNumber(char const *f, int *pos, double *value, char *logError, unsigned maxLogErrorSize, unsigned *errorPos);
 		
 		unsigned ParseMultiple(char const *f, int *pos, char *logError, unsigned maxLogErrorSize, unsigned *errorPos, LogicalExpression *parent);
 
@@ -654,12 +1616,14 @@ class Rule
 		Rule(wxString const &text, RuleDisplay *display = NULL)
 		{
 			m_expr = NULL;
+			m_valid = false;
 			SetRule(text, display);
 		}
 	
 		Rule()
 		{
 			m_expr = NULL;
+			m_valid = false;
 			m_errorPos = 0;
 		}
 
@@ -698,12 +1662,21 @@ class Rule
 		Rule(Rule const &other)
 		{
 			m_expr = NULL;
-			Create(other);
+			m_valid = false;
+			Create(other, other.m_scale);
+		}
+
+		// a copy of other, evaluated at scale
+		Rule(Rule const &other, RuleScale const &scale)
+		{
+			m_expr = NULL;
+			m_valid = false;
+			Create(other, scale);
 		}
 
 		Rule const &operator=(Rule const &other)
 		{
-			Create(other);
+			Create(other, other.m_scale);
 
 			return *this;
 		}
@@ -723,15 +1696,56 @@ class Rule
 
 			m_errorLog = wxString::FromUTF8(errorLog);
 
-			if (m_expr && m_expr->Valid())
+			// the expression doesn't change after this, so neither does its validity
+			m_valid = m_expr && m_expr->Valid();
+
+			m_program.Clear();
+			if (m_valid)
 			{
+				m_expr->SetScale(m_scale);
 				m_expr->Reorder(); // use a standard ordering, to make comparing easier
+				m_program.Compile(m_expr);
 			}
 			return m_expr;
 		}
 
 
-		bool IsValid() { return m_expr && m_expr->Valid(); }
+		// builds the tables the rule reads, see LogicalExpression::BuildTables(). it can't be evaluated
+		// before that. only on the gui thread
+		void BuildTables()
+		{
+			if (m_valid && m_expr->BuildTables())
+			{
+				m_program.Compile(m_expr);
+			}
+		}
+
+		// the scale to evaluate (zoom) and (minpixels) at. when that changes the value of the
+		// expression, its MD5 changes too, and the program is compiled again without the parts that
+		// are constant now
+		void SetScale(RuleScale const &scale)
+		{
+			if (scale == m_scale)
+			{
+				return;
+			}
+
+			m_scale = scale;
+
+			if (m_valid && m_expr->SetScale(scale))
+			{
+				m_expr->Reorder();
+				m_program.Compile(m_expr);
+			}
+		}
+
+		bool IsValid() { return m_valid; }
+
+		// what the rule was parsed from
+		wxString const &GetText() const
+		{
+			return m_text;
+		}
 		
 		wxString const &GetErrorLog()
 		{
@@ -745,7 +1759,7 @@ class Rule
 
 		bool Valid()
 		{
-			return m_expr && m_expr->Valid();
+			return m_valid;
 		}
 
 		ExpressionMD5 const &MD5() const
@@ -754,7 +1768,15 @@ class Rule
 			return m_expr ? m_expr->MD5() : s_empty;
 		}
 
-		LogicalExpression::STATE Evaluate(IdObjectWithTags *o)
+		// NULL if the rule isn't valid
+		LogicalExpression const *GetExpression() const
+		{
+			return m_valid ? m_expr : NULL;
+		}
+
+		// when profiling, every expression of the rule counts this evaluation in its profile. the
+		// rule can be evaluated on several threads at once, as long as none of them profiles
+		LogicalExpression::STATE Evaluate(IdObjectWithTags *o, bool profiling)
 		{
 			assert(Valid());
 			if (!m_expr)
@@ -762,15 +1784,118 @@ class Rule
 				return LogicalExpression::S_IGNORE;
 			}
 
-			return m_expr->GetValue(o);
+			// the program has no subexpressions left to profile
+			if (m_program.IsCompiled() && !profiling)
+			{
+				return m_program.Run(o);
+			}
+
+			// too deep to compile
+			return m_expr->Value(o, profiling);
+		}
+
+		void ClearProfile()
+		{
+			if (m_expr)
+			{
+				m_expr->ClearProfile();
+			}
+		}
+
+		// see LogicalExpression::ProfileText()
+		wxString ProfileText() const
+		{
+			wxString ret;
+			if (m_valid)
+			{
+				wxCharBuffer source = m_text.mb_str(wxConvUTF8);
+				m_expr->ProfileText(&ret, source, 0);
+			}
+			return ret;
+		}
+
+		unsigned GetPossibleStates(TagSummary const &summary) const
+		{
+			assert(m_expr);
+
+			return m_expr->GetPossibleStates(summary);
+		}
+
+		// the values of num objects at once, see RuleProgram::RunBatch(). the sets are cleared, and
+		// stay so for an invalid rule
+		void EvaluateBatch(IdObjectWithTags const * const *objects, unsigned num, IndexBitset *trueSet, IndexBitset *falseSet)
+		{
+			trueSet->Init(num);
+			falseSet->Init(num);
+
+			if (!m_valid)
+			{
+				return;
+			}
+
+			if (m_program.IsCompiled())
+			{
+				m_program.RunBatch(objects, num, trueSet, falseSet);
+				return;
+			}
+
+			// too deep to compile
+			for (unsigned i = 0; i < num; i++)
+			{
+				LogicalExpression::STATE s = m_expr->GetValue(const_cast<IdObjectWithTags *>(objects[i]), false);
+				if (s == LogicalExpression::S_TRUE)
+				{
+					trueSet->Set(i);
+				}
+				else if (s == LogicalExpression::S_FALSE)
+				{
+					falseSet->Set(i);
+				}
+			}
+		}
+
+		// see LogicalExpression::Select()
+		void Select(TagPostings const &postings, IdObject::KIND kind, IndexBitset *trueSet, IndexBitset *falseSet) const
+		{
+			if (m_expr)
+			{
+				m_expr->Select(postings, kind, trueSet, falseSet);
+			}
 		}
 	private:
-		void Create(Rule const &other)
+		// copies the parsed expression, the text isn't parsed again. at another scale only the parts
+		// that depend on it are evaluated again, and the program is only compiled again if they change
+		void Create(Rule const &other, RuleScale const &scale)
 		{
-			SetRule(other.m_text);
+			if (&other == this)
+			{
+				SetScale(scale);
+				return;
+			}
+
+			delete m_expr;
+			m_expr = other.m_expr ? other.m_expr->Clone() : NULL;
+			m_valid = other.m_valid;
+			m_text = other.m_text;
+			m_errorLog = other.m_errorLog;
+			m_errorPos = other.m_errorPos;
+			m_scale = scale;
+
+			if (m_valid && !(scale == other.m_scale) && m_expr->SetScale(scale))
+			{
+				m_expr->Reorder();
+				m_program.Compile(m_expr);
+			}
+			else
+			{
+				m_program.CopyFrom(other.m_program);
+			}
 		}
 		
 		LogicalExpression *m_expr;
+		bool m_valid;
+		RuleScale m_scale;
+		RuleProgram m_program;
 		wxString m_text;
 		wxString m_errorLog;
 		unsigned int m_errorPos;
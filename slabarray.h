@@ -17,6 +17,9 @@ class SlabArray
 		T const &Last() const { return Get(m_num - 1); }
 		T const &operator[](unsigned index) const { return Get(index); }
 
+		// bytes allocated for the slab table and the slabs
+		size_t GetMemoryUsage() const;
+
 	private:
 		unsigned m_slabSize;
 		unsigned m_slabShift;
@@ -108,7 +111,23 @@ void SlabArray<T, SlabSize>::GrowMaxNumSlabs()
 
 	delete [] m_slabs;
 	m_slabs = newSlabs;
-	m_maxNumSlabs++;
+	m_maxNumSlabs = newNumSlabs;
+}
+
+template<typename T, size_t SlabSize>
+size_t SlabArray<T, SlabSize>::GetMemoryUsage() const
+{
+	size_t ret = m_maxNumSlabs * sizeof(T *);
+
+	for (unsigned i = 0; i < m_maxNumSlabs; i++)
+	{
+		if (m_slabs[i])
+		{
+			ret += m_slabSize * sizeof(T);
+		}
+	}
+
+	return ret;
 }
 
 #endif //__SLABARRAY_H__
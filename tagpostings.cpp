@@ -0,0 +1,272 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#include "tagpostings.h"
+#include "memoryreport.h"
+
+#define NOLIST 0xFFFFFFFF
+
+IndexBitset::IndexBitset(unsigned num)
+{
+	m_words = NULL;
+	m_num = 0;
+	m_maxWords = 0;
+	Init(num);
+}
+
+IndexBitset::~IndexBitset()
+{
+	delete [] m_words;
+}
+
+void IndexBitset::Init(unsigned num)
+{
+	m_num = num;
+
+	if (!m_words || GetNumWords() > m_maxWords)
+	{
+		delete [] m_words;
+		m_maxWords = GetNumWords() ? GetNumWords() : 1;
+		m_words = new wxUint64[m_maxWords];
+	}
+
+	Clear();
+}
+
+void IndexBitset::Clear()
+{
+	memset(m_words, 0, sizeof(wxUint64) * GetNumWords());
+}
+
+void IndexBitset::SetAll()
+{
+	memset(m_words, 0xFF, sizeof(wxUint64) * GetNumWords());
+
+	// keep the bits past the end clear, so Count() is right
+	if (m_num & 63)
+	{
+		m_words[GetNumWords() - 1] = ((wxUint64)1 << (m_num & 63)) - 1;
+	}
+}
+
+void IndexBitset::Or(IndexBitset const &other)
+{
+	assert(other.m_num == m_num);
+	for (unsigned i = 0; i < GetNumWords(); i++)
+	{
+		m_words[i] |= other.m_words[i];
+	}
+}
+
+void IndexBitset::AndNot(IndexBitset const &other)
+{
+	assert(other.m_num == m_num);
+	for (unsigned i = 0; i < GetNumWords(); i++)
+	{
+		m_words[i] &= ~other.m_words[i];
+	}
+}
+
+unsigned IndexBitset::Count() const
+{
+	unsigned ret = 0;
+	for (unsigned i = 0; i < GetNumWords(); i++)
+	{
+		ret += __builtin_popcountll(m_words[i]);
+	}
+
+	return ret;
+}
+
+TagPostings::TagPostings()
+{
+	m_numObjects = 0;
+	m_numKeys = 0;
+	m_numLists = 0;
+	m_valueLists = NULL;
+	m_offsets = NULL;
+	m_counts = NULL;
+	m_data = NULL;
+}
+
+TagPostings::~TagPostings()
+{
+	delete [] m_valueLists;
+	delete [] m_offsets;
+	delete [] m_counts;
+	delete [] m_data;
+}
+
+static unsigned VarintSize(unsigned v)
+{
+	unsigned ret = 1;
+	while (v >= 0x80)
+	{
+		v >>= 7;
+		ret++;
+	}
+
+	return ret;
+}
+
+static unsigned char *PutVarint(unsigned char *p, unsigned v)
+{
+	while (v >= 0x80)
+	{
+		*p++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (unsigned char)v;
+
+	return p;
+}
+
+void TagPostings::Build(IdObjectArrayLarge *objects)
+{
+	TagStore *store = OsmTag::m_tagStore;
+
+	m_numObjects = objects->GetCount();
+	m_numKeys = store ? store->GetNumKeys() : 0;
+
+	delete [] m_valueLists;
+	m_valueLists = new unsigned[m_numKeys ? m_numKeys : 1];
+	m_numLists = m_numKeys;
+	for (unsigned k = 0; k < m_numKeys; k++)
+	{
+		m_valueLists[k] = m_numLists;
+		m_numLists += store->GetNumValues(k);
+	}
+
+	delete [] m_offsets;
+	delete [] m_counts;
+	m_offsets = new size_t[m_numLists + 1];
+	m_counts = new unsigned[m_numLists ? m_numLists : 1];
+	memset(m_offsets, 0, sizeof(size_t) * (m_numLists + 1));
+	memset(m_counts, 0, sizeof(unsigned) * (m_numLists ? m_numLists : 1));
+
+	// per list the last index added + 1, so the first delta is index + 1 and never 0. an object with the
+	// same key twice gets a delta of 0 for the key list, which is skipped
+	unsigned *next = new unsigned[m_numLists ? m_numLists : 1];
+
+	// two passes over the objects: the first sizes the lists, the second fills them
+	for (int pass = 0; pass < 2; pass++)
+	{
+		memset(next, 0, sizeof(unsigned) * (m_numLists ? m_numLists : 1));
+
+		for (unsigned i = 0; i < m_numObjects; i++)
+		{
+			IdObjectWithTags *o = static_cast<IdObjectWithTags *>(objects->Get(i));
+
+			for (OsmTag *t = o->m_tags; t; t = static_cast<OsmTag *>(t->m_next))
+			{
+				unsigned lists[2] = { t->m_index.m_keyIndex, GetList(t->m_index) };
+
+				for (int l = 0; l < 2; l++)
+				{
+					unsigned list = lists[l];
+					if (list == NOLIST || list >= m_numLists || next[list] == i + 1)
+					{
+						continue;
+					}
+
+					unsigned delta = i + 1 - next[list];
+					next[list] = i + 1;
+
+					if (pass)
+					{
+						PutVarint(m_data + m_offsets[list + 1], delta);
+						m_offsets[list + 1] += VarintSize(delta);
+					}
+					else
+					{
+						m_offsets[list + 1] += VarintSize(delta);
+						m_counts[list]++;
+					}
+				}
+			}
+		}
+
+		if (!pass)
+		{
+			// sizes to starts. m_offsets[l + 1] is then used as the write cursor of list l, which ends up at
+			// the start of list l + 1
+			size_t total = 0;
+			for (unsigned l = 0; l < m_numLists; l++)
+			{
+				size_t size = m_offsets[l + 1];
+				m_offsets[l + 1] = total;
+				total += size;
+			}
+			m_offsets[0] = 0;
+
+			delete [] m_data;
+			m_data = new unsigned char[total ? total : 1];
+		}
+	}
+
+	delete [] next;
+}
+
+unsigned TagPostings::GetList(TagIndex const &index) const
+{
+	if (index.m_keyIndex >= m_numKeys)
+	{
+		return NOLIST;
+	}
+
+	if (!index.m_valueIndex)
+	{
+		return index.m_keyIndex;
+	}
+
+	unsigned list = m_valueLists[index.m_keyIndex] + index.m_valueIndex - 1;
+	unsigned end = index.m_keyIndex + 1 < m_numKeys ? m_valueLists[index.m_keyIndex + 1] : m_numLists;
+
+	return list < end ? list : NOLIST;
+}
+
+TagPostings::Iterator TagPostings::Get(TagIndex const &index) const
+{
+	Iterator ret;
+	unsigned list = GetList(index);
+
+	if (list != NOLIST)
+	{
+		ret.m_pos = m_data + m_offsets[list];
+		ret.m_left = m_counts[list];
+	}
+
+	return ret;
+}
+
+unsigned TagPostings::GetCount(TagIndex const &index) const
+{
+	unsigned list = GetList(index);
+
+	return list == NOLIST ? 0 : m_counts[list];
+}
+
+void TagPostings::Select(TagIndex const &index, IndexBitset *set) const
+{
+	Iterator it = Get(index);
+	unsigned i;
+
+	while (it.Next(&i))
+	{
+		set->Set(i);
+	}
+}
+
+void TagPostings::ReportMemory(MemoryReport *report, wxString const &name)
+{
+	size_t bytes = m_offsets ? m_offsets[m_numLists] : 0;
+	size_t numPostings = 0;
+
+	for (unsigned l = 0; l < m_numLists; l++)
+	{
+		numPostings += m_counts[l];
+	}
+
+	report->Add(name + wxT(" tag postings"), numPostings, bytes);
+	report->Add(name + wxT(" tag posting tables"), m_numLists, m_numLists * (sizeof(size_t) + sizeof(unsigned)) + m_numKeys * sizeof(unsigned));
+}
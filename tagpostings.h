@@ -0,0 +1,147 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#ifndef __TAGPOSTINGS_H__
+#define __TAGPOSTINGS_H__
+
+#include "osm.h"
+
+class MemoryReport;
+
+// a set of object indices in [0, num), one bit per index
+class IndexBitset
+{
+	public:
+		IndexBitset(unsigned num = 0);
+		~IndexBitset();
+
+		// resizes to num, and clears all bits. the storage only grows, so reusing a set for batches
+		// of about the same size doesn't allocate
+		void Init(unsigned num);
+
+		void Clear();
+		void SetAll();
+
+		void Set(unsigned i)
+		{
+			assert(i < m_num);
+			m_words[i >> 6] |= (wxUint64)1 << (i & 63);
+		}
+
+		bool Test(unsigned i) const
+		{
+			assert(i < m_num);
+			return m_words[i >> 6] & ((wxUint64)1 << (i & 63));
+		}
+
+		// bits 64 * word up to 64 * word + 63 at once
+		void SetWord(unsigned word, wxUint64 bits)
+		{
+			assert(word < GetNumWords());
+			m_words[word] = bits;
+		}
+
+		void Or(IndexBitset const &other);
+		void AndNot(IndexBitset const &other);
+
+		unsigned Count() const;
+
+		unsigned GetNum() const
+		{
+			return m_num;
+		}
+
+	private:
+		IndexBitset(IndexBitset const &other);
+		IndexBitset const &operator=(IndexBitset const &other);
+
+		unsigned GetNumWords() const
+		{
+			return (m_num + 63) >> 6;
+		}
+
+		wxUint64 *m_words;
+		unsigned m_num;
+		unsigned m_maxWords;
+};
+
+// inverted index over the tags of one kind of object. for every key and every key=value pair in the
+// TagStore it keeps the ascending indices of the objects that have it, delta encoded as varints.
+// tags added to the TagStore after Build() have empty lists
+class TagPostings
+{
+	public:
+		class Iterator
+		{
+			public:
+				Iterator()
+				{
+					m_pos = NULL;
+					m_left = 0;
+					m_next = 0;
+				}
+
+				// false when there are no more indices
+				bool Next(unsigned *index)
+				{
+					if (!m_left)
+					{
+						return false;
+					}
+
+					unsigned delta = 0;
+					unsigned shift = 0;
+					while (*m_pos & 0x80)
+					{
+						delta |= (*m_pos++ & 0x7F) << shift;
+						shift += 7;
+					}
+					delta |= *m_pos++ << shift;
+
+					m_next += delta;
+					*index = m_next - 1;
+					m_left--;
+					return true;
+				}
+
+			private:
+				friend class TagPostings;
+				unsigned char const *m_pos;
+				unsigned m_left;
+				unsigned m_next; // the last index returned + 1
+		};
+
+		TagPostings();
+		~TagPostings();
+
+		void Build(IdObjectArrayLarge *objects);
+
+		unsigned GetNumObjects() const
+		{
+			return m_numObjects;
+		}
+
+		// the objects with a tag that matches index. a value index of 0 matches any value, like
+		// TagIndex::Matches()
+		Iterator Get(TagIndex const &index) const;
+		unsigned GetCount(TagIndex const &index) const;
+
+		// sets the bits of the objects with a tag that matches index
+		void Select(TagIndex const &index, IndexBitset *set) const;
+
+		void ReportMemory(MemoryReport *report, wxString const &name);
+
+	private:
+		// NOLIST if the TagStore didn't know index at Build() time
+		unsigned GetList(TagIndex const &index) const;
+
+		unsigned m_numObjects;
+		unsigned m_numKeys;
+		unsigned m_numLists;
+		unsigned *m_valueLists; // per key, the list of its first value. the list of the key itself is the key index
+		size_t *m_offsets;      // per list, its start in m_data. one extra for the end
+		unsigned *m_counts;     // per list, the number of indices in it
+		unsigned char *m_data;
+};
+
+#endif
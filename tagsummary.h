@@ -0,0 +1,133 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#ifndef __TAGSUMMARY_H__
+#define __TAGSUMMARY_H__
+
+#include "osm.h"
+
+#define TAGSUMMARYBITS 512
+#define TAGSUMMARYWORDS (TAGSUMMARYBITS / 64)
+
+// keys with more values than this in the TagStore only have the key in the filter
+#define TAGSUMMARYMAXVALUES 128
+
+// compact, conservative summary of the tags of a set of objects: a bloom filter over the keys and the
+// key=value pairs, plus the kinds of objects. MayHave() can give false positives, never false negatives,
+// so a rule that can't match the summary can't match any of the objects. keys like name, ref or the
+// addr:* ones have a value per object, their pairs would fill the filter, so only their keys are added,
+// and any value of them is taken to be there if the key is. the TagStore only gains values, so a key
+// that had too many when a summary was built still has
+class TagSummary
+{
+	public:
+		TagSummary()
+		{
+			Clear();
+		}
+
+		void Clear()
+		{
+			memset(m_bits, 0, sizeof(m_bits));
+			m_kinds = 0;
+		}
+
+		void Add(IdObjectWithTags const *o)
+		{
+			m_kinds |= 1 << o->m_kind;
+
+			for (OsmTag *t = o->m_tags; t; t = static_cast<OsmTag *>(t->m_next))
+			{
+				if (!t->m_index.m_valueIndex)
+				{
+					// matches a rule tag with any value, which a bloom filter can't express
+					Saturate();
+					return;
+				}
+
+				Set(t->m_index.m_keyIndex, 0);
+				if (HasPairs(t->m_index.m_keyIndex))
+				{
+					Set(t->m_index.m_keyIndex, t->m_index.m_valueIndex);
+				}
+			}
+		}
+
+		void Add(TagSummary const &other)
+		{
+			for (unsigned i = 0; i < TAGSUMMARYWORDS; i++)
+			{
+				m_bits[i] |= other.m_bits[i];
+			}
+			m_kinds |= other.m_kinds;
+		}
+
+		// false if no object has a tag that matches index. a value index of 0 matches any value
+		bool MayHave(TagIndex const &index) const
+		{
+			unsigned b1, b2;
+			Hash(index.m_keyIndex, HasPairs(index.m_keyIndex) ? index.m_valueIndex : 0, &b1, &b2);
+			return Test(b1) && Test(b2);
+		}
+
+		// the number of bits set, to see how full the filter is
+		unsigned CountBits() const
+		{
+			unsigned ret = 0;
+			for (unsigned i = 0; i < TAGSUMMARYWORDS; i++)
+			{
+				ret += __builtin_popcountll(m_bits[i]);
+			}
+			return ret;
+		}
+
+		bool MayHaveKind(IdObject::KIND kind) const
+		{
+			return m_kinds & (1 << kind);
+		}
+
+		// true if there are objects of another kind than this one
+		bool MayHaveOtherThan(IdObject::KIND kind) const
+		{
+			return m_kinds & ~(1 << kind);
+		}
+
+	private:
+		// true if the key=value pairs of key go into the filter, not only the key
+		static bool HasPairs(unsigned key)
+		{
+			TagStore *store = OsmTag::m_tagStore;
+			return store && key < store->GetNumKeys() && store->GetNumValues(key) <= TAGSUMMARYMAXVALUES;
+		}
+
+		static void Hash(unsigned key, unsigned value, unsigned *b1, unsigned *b2)
+		{
+			wxUint64 h = ((wxUint64)key << 32 | value) * 0x9E3779B97F4A7C15ULL;
+			h ^= h >> 29;
+			*b1 = (unsigned)(h % TAGSUMMARYBITS);
+			*b2 = (unsigned)((h >> 32) % TAGSUMMARYBITS);
+		}
+
+		void Set(unsigned key, unsigned value)
+		{
+			unsigned b1, b2;
+			Hash(key, value, &b1, &b2);
+			m_bits[b1 / 64] |= (wxUint64)1 << (b1 % 64);
+			m_bits[b2 / 64] |= (wxUint64)1 << (b2 % 64);
+		}
+
+		bool Test(unsigned bit) const
+		{
+			return m_bits[bit / 64] & ((wxUint64)1 << (bit % 64));
+		}
+
+		void Saturate()
+		{
+			memset(m_bits, 0xFF, sizeof(m_bits));
+		}
+
+		wxUint64 m_bits[TAGSUMMARYWORDS];
+		unsigned m_kinds; // bit per IdObject::KIND
+};
+
+#endif
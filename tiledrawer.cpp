@@ -4,80 +4,567 @@
 #include "tiledrawer.h"
 #include "rulecontrol.h"
 #include "polygonassembler.h"
+#include "memoryreport.h"
+#include "workerpool.h"
 
-TileWay::TileWay(OsmWay *way, TileWay *next)
-	: ListObject(next)
+
+TileDrawer::TileDrawer(OsmData *data, double minX, double minY, double maxX, double maxY, unsigned maxWaysPerTile, unsigned maxDepth)
 {
-	m_way = way;
+	m_data = data;
+	m_ways = NULL;
+	m_selection = NULL;
+	m_selectionColor = wxColour(255,0,0);
+	m_selectedWay = NULL;
+	m_selectedRelation = NULL;
+	m_selectedTile = NULL;
+
+	m_drawRule = NULL;
+	m_colorRules = NULL;
+	m_snapshot = NULL;
+	m_rules = NULL;
+	m_profiling = false;
+	m_classifierRules = NULL;
+	m_drawResults = NULL;
+	m_colorStates = NULL;
+	m_batch = NULL;
+	m_maxBatch = 0;
+	m_useBakedStyles = false;
+	m_ruleCache.Init(data->m_ways.m_objects.GetCount(), data->m_relations.m_objects.GetCount());
+	m_styles.Init(data->m_ways.m_objects.GetCount(), data->m_relations.m_objects.GetCount());
+
+	m_renderedWays.Init(data->m_ways.m_objects.GetCount());
+	m_renderedRelations.Init(data->m_relations.m_objects.GetCount());
+	m_generation = 0;
+
+	m_maxWaysPerTile = maxWaysPerTile ? maxWaysPerTile : 1;
+	m_maxDepth = maxDepth;
+
+	// make the root square, so all tiles are, and a little larger than the data, so nodes on the
+	// border are inside a tile
+	double size = maxX - minX > maxY - minY ? maxX - minX : maxY - minY;
+	size += 2;
+	minX -= 1;
+	minY -= 1;
+
+	m_root = new TileTreeNode(minX, minY, minX + size, minY + size);
+	m_numTreeNodes = 1;
+
+	// until AddWays() is called, the root is the only tile
+	m_root->m_tile = new OsmTile(0, minX, minY, minX + size, minY + size);
+	m_tiles.Add(m_root->m_tile);
 }
 
-TileWay::~TileWay()
+// finds the tiles every way intersects. the pairs are collected per block instead of per thread, so
+// merging the blocks in order gives every tile its ways in ascending order, however the blocks
+// were spread over the threads
+class BinWaysJob
+	: public ParallelJob
+{
+	public:
+		BinWaysJob(TileDrawer *drawer, IdObjectArrayLarge *ways, DRect const *bbs, unsigned blockSize)
+		{
+			m_drawer = drawer;
+			m_ways = ways;
+			m_bbs = bbs;
+			m_blockSize = blockSize;
+			m_numBlocks = (ways->GetCount() + blockSize - 1) / blockSize;
+			m_pairs = new wxArrayInt[m_numBlocks ? m_numBlocks : 1];
+		}
+
+		~BinWaysJob()
+		{
+			delete [] m_pairs;
+		}
+
+		void Run(unsigned thread, unsigned from, unsigned to)
+		{
+			wxArrayInt &pairs = m_pairs[from / m_blockSize];
+
+			for (unsigned i = from; i < to; i++)
+			{
+				m_drawer->BinWay(m_drawer->m_root, static_cast<OsmWay *>(m_ways->Get(i)), i, m_bbs[i], pairs);
+			}
+		}
+
+		unsigned GetNumBlocks() const
+		{
+			return m_numBlocks;
+		}
+
+		wxArrayInt const &GetPairs(unsigned block) const
+		{
+			return m_pairs[block];
+		}
+
+	private:
+		TileDrawer *m_drawer;
+		IdObjectArrayLarge *m_ways;
+		DRect const *m_bbs;
+		unsigned m_blockSize;
+		unsigned m_numBlocks;
+		wxArrayInt *m_pairs;
+};
+
+// builds the tag summaries of the tiles
+class TileSummaryJob
+	: public ParallelJob
+{
+	public:
+		TileSummaryJob(TileDrawer *drawer, OsmData *data, OsmTileArray *tiles)
+		{
+			m_drawer = drawer;
+			m_data = data;
+			m_tiles = tiles;
+		}
+
+		void Run(unsigned thread, unsigned from, unsigned to)
+		{
+			for (unsigned t = from; t < to; t++)
+			{
+				OsmTile *tile = (*m_tiles)[t];
+				tile->m_tagSummary.Clear();
+
+				for (unsigned i = 0; i < tile->m_numWays; i++)
+				{
+					OsmWay *way = m_drawer->GetTileWay(tile, i);
+					tile->m_tagSummary.Add(way);
+
+					unsigned numRelations = m_data->GetNumRelationsContainingWay(way);
+					for (unsigned r = 0; r < numRelations; r++)
+					{
+						tile->m_tagSummary.Add(m_data->GetRelationContainingWay(way, r));
+					}
+				}
+			}
+		}
+
+	private:
+		TileDrawer *m_drawer;
+		OsmData *m_data;
+		OsmTileArray *m_tiles;
+};
+
+#define BINBLOCKSIZE 256
+
+void TileDrawer::AddWays(IdObjectArrayLarge *ways)
 {
+	unsigned num = ways->GetCount();
+
+	WorkerPool pool(0, BINBLOCKSIZE);
+
+	// the boxes of the ways, by their index, are kept by OsmData::Resolve()
+	wxASSERT(OsmWay::m_wayBBs);
+	DRect const *bbs = OsmWay::m_wayBBs;
+
+	wxArrayInt candidates;
+	candidates.Alloc(num);
+	for (unsigned i = 0; i < num; i++)
+	{
+		candidates.Add(i);
+	}
+
+	// throw away the initial single tile, the tree gets rebuilt from scratch
+	WX_CLEAR_ARRAY(m_tiles);
+	m_tiles.Clear();
+	m_root->m_tile = NULL;
+
+	// the shape of the tree only depends on the bounding boxes, which is cheap enough to do serially.
+	// the exact intersection tests are what take the time
+	BuildTree(m_root, bbs, candidates, 0);
+
+	BinWaysJob bin(this, ways, bbs, BINBLOCKSIZE);
+	pool.Run(&bin, num);
+
+	// counting sort the pairs into one contiguous array, with the ways of each tile together
+	unsigned numTiles = m_tiles.GetCount();
+	m_tileWays.Init(numTiles);
+	for (unsigned b = 0; b < bin.GetNumBlocks(); b++)
+	{
+		wxArrayInt const &pairs = bin.GetPairs(b);
+		for (unsigned i = 0; i < pairs.GetCount(); i += 2)
+		{
+			m_tileWays.Count(pairs[i]);
+		}
+	}
+	m_tileWays.Allocate();
+	for (unsigned b = 0; b < bin.GetNumBlocks(); b++)
+	{
+		wxArrayInt const &pairs = bin.GetPairs(b);
+		for (unsigned i = 0; i < pairs.GetCount(); i += 2)
+		{
+			m_tileWays.Fill(pairs[i], pairs[i + 1]);
+		}
+	}
+
+	for (unsigned t = 0; t < numTiles; t++)
+	{
+		m_tiles[t]->m_ways = m_tileWays.Get(t);
+		m_tiles[t]->m_numWays = m_tileWays.GetCount(t);
+	}
+
+	m_ways = ways;
+
+	WorkerPool summaryPool(0, 1);
+	TileSummaryJob summaries(this, m_data, &m_tiles);
+	summaryPool.Run(&summaries, numTiles);
+
+	printf("sorted %uK ways into %u tiles\n", num / 1000, numTiles);
+
+	m_pyramid.Build(ways);
+	m_nodeIndex.Build(m_data);
 }
 
+void TileDrawer::BuildTree(TileTreeNode *node, DRect const *bbs, wxArrayInt &candidates, unsigned depth)
+{
+	// ways whose bounding box covers the whole node end up in all of its children, so splitting
+	// doesn't help for them. don't count them, or big ways would split the tree to the maximum depth
+	unsigned count = 0;
+	for (unsigned i = 0; i < candidates.GetCount() && count <= m_maxWaysPerTile; i++)
+	{
+		if (!node->IsInside(bbs[candidates[i]]))
+		{
+			count++;
+		}
+	}
+
+	if (count <= m_maxWaysPerTile || depth >= m_maxDepth)
+	{
+		node->m_tile = new OsmTile(m_tiles.GetCount(), node->m_x, node->m_y, node->Right(), node->Top());
+		m_tiles.Add(node->m_tile);
+
+		return;
+	}
+
+	double cx = node->m_x + node->m_w / 2;
+	double cy = node->m_y + node->m_h / 2;
 
-TileWay *OsmTile::GetWaysContainingNode(OsmNode *node)
+	for (int q = 0; q < 4; q++)
+	{
+		double minX = (q & 1) ? cx : node->m_x;
+		double minY = (q & 2) ? cy : node->m_y;
+		double maxX = (q & 1) ? node->Right() : cx;
+		double maxY = (q & 2) ? node->Top() : cy;
+
+		TileTreeNode *child = new TileTreeNode(minX, minY, maxX, maxY);
+		node->m_children[q] = child;
+		m_numTreeNodes++;
+
+		wxArrayInt childCandidates;
+		for (unsigned i = 0; i < candidates.GetCount(); i++)
+		{
+			if (child->Touches(bbs[candidates[i]]))
+			{
+				childCandidates.Add(candidates[i]);
+			}
+		}
+
+		BuildTree(child, bbs, childCandidates, depth + 1);
+	}
+}
+
+void TileDrawer::BinWay(TileTreeNode const *node, OsmWay *way, unsigned index, DRect const &bb, wxArrayInt &pairs) const
 {
-	TileWay *ret = NULL;
+	if (node->m_tile)
+	{
+		if (way->Intersects(*(node->m_tile)))
+		{
+			pairs.Add(node->m_tile->m_id);
+			pairs.Add(index);
+		}
+
+		return;
+	}
 
-	for (TileWay *t = m_ways; t; t = static_cast<TileWay *>(t->m_next))
+	for (int q = 0; q < 4; q++)
 	{
-		if (t->m_way->ContainsNode(node))
+		if (node->m_children[q]->Touches(bb))
 		{
-			ret = new TileWay(t->m_way, ret);
+			BinWay(node->m_children[q], way, index, bb, pairs);
 		}
 	}
+}
+
+
+unsigned TileDrawer::NextGeneration()
+{
+	m_generation++;
+
+	// wrapped around, old stamps could match again
+	if (!m_generation)
+	{
+		m_renderedWays.Clear();
+		m_renderedRelations.Clear();
+		m_generation = 1;
+	}
+
+	return m_generation;
+}
+
+RuleScale TileDrawer::GetRuleScale(Renderer *renderer)
+{
+	// the rules are evaluated at the scale of the viewport on the output
+	return RuleScale(renderer->GetWidth() > 0 ? renderer->GetViewport().m_w / renderer->GetWidth() : 0);
+}
+
+RuleSet *TileDrawer::CreateRules(Renderer *renderer)
+{
+	return new RuleSet(m_drawRule, m_colorRules, GetRuleScale(renderer));
+}
+
+RuleSet *TileDrawer::SnapshotRules(Renderer *renderer)
+{
+	RuleScale scale = GetRuleScale(renderer);
+
+	if (!m_snapshot || !m_snapshot->IsSnapshotOf(m_drawRule, m_colorRules, scale))
+	{
+		if (m_snapshot)
+		{
+			m_snapshot->UnRef();
+		}
+
+		m_snapshot = new RuleSet(m_drawRule, m_colorRules, scale);
+		m_snapshot->Ref();
+
+		// switching to rules that were baked before. the baked styles of the last ones are kept
+		// otherwise, switching back needs no loading
+		if (!m_cacheFile.IsEmpty() && !m_bakedStyles.IsFor(m_snapshot))
+		{
+			m_bakedStyles.Load(BakedStyles::GetFileName(m_cacheFile, m_snapshot), m_cacheFile, m_snapshot, m_data);
+		}
+	}
+
+	return m_snapshot;
+}
+
+bool TileDrawer::BakeStyles(RuleSet *rules)
+{
+	m_bakedStyles.Bake(rules, m_data);
+
+	return !m_cacheFile.IsEmpty() && m_bakedStyles.Save(BakedStyles::GetFileName(m_cacheFile, rules));
+}
+
+void TileDrawer::FetchRuleResults()
+{
+	m_ruleCache.StartRound();
+
+	// an invalid rule is S_IGNORE for everything, and has no MD5 to look it up by
+	Rule *drawRule = m_rules->GetDrawRule();
+	m_drawResults = drawRule ? m_ruleCache.Get(drawRule->MD5()) : NULL;
+
+	m_colorResults.Clear();
+	unsigned numColorRules = m_rules->GetNumColorRules();
+	Rule **rules = m_rules->GetColorRules();
+	for (unsigned i = 0; i < numColorRules; i++)
+	{
+		m_colorResults.Add(rules[i]->Valid() ? m_ruleCache.Get(rules[i]->MD5()) : NULL);
+	}
+
+	// a classifier built from the same rules in another RuleSet is kept, and so is that RuleSet
+	if (!m_colorClassifier.IsBuiltFrom(rules, numColorRules))
+	{
+		// objects that matched a rule before the first changed one still do
+		m_styles.Invalidate(m_colorClassifier.GetFirstDifference(rules, numColorRules));
+		m_colorClassifier.Build(rules, numColorRules);
+		delete [] m_colorStates;
+		m_colorStates = new unsigned char[numColorRules ? numColorRules : 1];
+
+		m_rules->Ref();
+		if (m_classifierRules)
+		{
+			m_classifierRules->UnRef();
+		}
+		m_classifierRules = m_rules;
+	}
+}
+
+LogicalExpression::STATE TileDrawer::Evaluate(Rule *rule, RuleResults *results, IdObjectWithTags *o)
+{
+	LogicalExpression::STATE ret;
+
+	// the cached values would hide the evaluations from the profile
+	if (m_profiling)
+	{
+		return rule->Evaluate(o, true);
+	}
+
+	if (results && results->Get(o, &ret))
+	{
+		return ret;
+	}
+
+	ret = rule->Evaluate(o, false);
+
+	if (results)
+	{
+		results->Set(o, ret);
+	}
 
 	return ret;
 }
 
+void TileDrawer::EvaluateDrawRule(OsmTile const *t)
+{
+	Rule *drawRule = m_rules->GetDrawRule();
+
+	if (!drawRule || !m_drawResults || m_useBakedStyles || m_profiling)
+	{
+		return;
+	}
+
+	if (t->m_numWays > m_maxBatch)
+	{
+		delete [] m_batch;
+		m_maxBatch = t->m_numWays;
+		m_batch = new IdObjectWithTags const *[m_maxBatch];
+	}
+
+	unsigned num = 0;
+	for (unsigned i = 0; i < t->m_numWays; i++)
+	{
+		LogicalExpression::STATE s;
+		OsmWay *way = GetTileWay(t, i);
+
+		if (!m_drawResults->Get(way, &s))
+		{
+			m_batch[num++] = way;
+		}
+	}
+
+	if (!num)
+	{
+		return;
+	}
+
+	drawRule->EvaluateBatch(m_batch, num, &m_batchTrue, &m_batchFalse);
+
+	for (unsigned i = 0; i < num; i++)
+	{
+		LogicalExpression::STATE s = LogicalExpression::S_IGNORE;
+		if (m_batchTrue.Test(i))
+		{
+			s = LogicalExpression::S_TRUE;
+		}
+		else if (m_batchFalse.Test(i))
+		{
+			s = LogicalExpression::S_FALSE;
+		}
+
+		m_drawResults->Set(m_batch[i], s);
+	}
+}
+
+int TileDrawer::GetColorRule(IdObjectWithTags *o)
+{
+	int ret;
+
+	// every rule up to the match is evaluated on its own, so it shows up in its profile
+	if (m_profiling)
+	{
+		Rule **rules = m_rules->GetColorRules();
+		for (unsigned i = 0; i < m_rules->GetNumColorRules(); i++)
+		{
+			if (rules[i]->Valid() && rules[i]->Evaluate(o, true) == LogicalExpression::S_TRUE)
+			{
+				return i;
+			}
+		}
+
+		return -1;
+	}
+
+	if (m_styles.Get(o, &ret))
+	{
+		return ret;
+	}
+
+	unsigned num = m_colorClassifier.GetNumRules();
+	ret = -1;
+
+	// the first rules may be known already. from the first one that isn't, the classifier does the
+	// rest in one go, and what it finds is remembered
+	for (unsigned i = 0; i < num; i++)
+	{
+		LogicalExpression::STATE s;
+		if (m_colorResults[i] && m_colorResults[i]->Get(o, &s))
+		{
+			if (s == LogicalExpression::S_TRUE)
+			{
+				ret = i;
+				break;
+			}
+
+			continue;
+		}
+
+		unsigned match = m_colorClassifier.Classify(o, i, m_colorStates);
+		for (unsigned j = i; j < num && j <= match; j++)
+		{
+			if (m_colorResults[j] && m_colorStates[j] != RULECLASSIFIERNOTEVALUATED)
+			{
+				m_colorResults[j]->Set(o, static_cast<LogicalExpression::STATE>(m_colorStates[j]));
+			}
+		}
+
+		ret = match < num ? (int)match : -1;
+		break;
+	}
+
+	m_styles.Set(o, ret);
+	return ret;
+}
 
-TileDrawer::TileDrawer(double minLon,double minLat, double maxLon, double maxLat, double dLon, double dLat)
+bool TileDrawer::GetStyle(IdObjectWithTags *o, RuleStyle *style)
 {
-	m_selection = NULL;
-	m_selectionColor = wxColour(255,0,0);
-	m_selectedWay = NULL;
-	m_selectedRelation = NULL;
-	m_selectedTile = NULL;
+	int i;
 
-	m_drawRule = NULL;
-	m_colorRules = NULL;
+	if (m_useBakedStyles)
+	{
+		wxUint16 baked = m_bakedStyles.Get(o);
+		if (baked == BAKEDSTYLEHIDDEN)
+		{
+			return false;
+		}
 
-	m_xNum = static_cast<int>((maxLon - minLon) / dLon) + 1;
-	m_yNum = static_cast<int>((maxLat - minLat) / dLat) + 1;
-	m_minLon = minLon;
-	m_w = m_xNum * dLon;
-	m_minLat = minLat;
-	m_h = m_yNum *dLat;
-	m_dLon = dLon;
-	m_dLat = dLat;
-	unsigned id = 0;
-	// build a list of empty tiles;
-	m_tileArray = new OsmTile **[m_xNum];
-	for (unsigned x = 0; x < m_xNum; x++)
+		i = baked == BAKEDSTYLENONE ? -1 : baked;
+	}
+	else
 	{
-		m_tileArray[x] = new OsmTile *[m_yNum];
-		for (unsigned y = 0; y < m_yNum; y++)
+		Rule *drawRule = m_rules->GetDrawRule();
+		if (drawRule && (Evaluate(drawRule, m_drawResults, o) == LogicalExpression::S_FALSE))
 		{
-			m_tiles.Add(new OsmTile(id++, m_minLon + x * dLon , m_minLat + y * dLat, m_minLon + (x + 1) * dLon, m_minLat + (y+1) * dLat));
-			m_tileArray[x][y] = m_tiles.Last();
+			return false;
 		}
+
+		i = GetColorRule(o);
 	}
- }
 
+	if (i >= 0)
+	{
+		*style = m_rules->GetStyle(i);
+	}
+
+	return true;
+}
 
 bool TileDrawer::RenderTiles(RenderJob *job, int maxNumToRender)
 {
 	bool mustCancel = false;
 
+	// another job can have drawn with other rules since the last call
+	m_rules = job->m_rules;
+	m_profiling = job->m_profiling;
+	FetchRuleResults();
+	m_useBakedStyles = !m_profiling && m_bakedStyles.IsFor(m_rules);
 
-	if (!job->m_visibleTiles)
+
+	if (!job->m_visibleTiles && !job->m_finished)
 	{
 		job->m_visibleTiles = GetTiles(job->m_bb);
+		job->m_generation = NextGeneration();
 
 		job->m_curTile = job->m_visibleTiles;
 
-		job->m_numTilesToRender = job->m_visibleTiles->GetSize();
+		job->m_numTilesToRender = job->m_visibleTiles ? job->m_visibleTiles->GetSize() : 0;
 		job->m_numTilesRendered = 0;
 	}
 
@@ -91,27 +578,35 @@ bool TileDrawer::RenderTiles(RenderJob *job, int maxNumToRender)
 	while (job->m_curTile && !mustCancel && (count++ < maxNumToRender))
 	{
 		OsmTile *t = job->m_curTile->m_tile;
-		if (t->m_ways)
+		if (t->m_numWays)
 		{
 			if (job->m_curLayer < 0) // curlayer < 0 means the renderer supports layers
 			{
 				Rect(job->m_renderer, wxEmptyString, *t, -1, 0,155,55, 20, NUMLAYERS);
 			}
 			
-			if (t->OverLaps(job->m_bb))
+			// skip tiles of which the summary proves the draw rule hides everything in them
+			if (t->OverLaps(job->m_bb) && m_rules->CanDraw(t->m_tagSummary))
 			{
-				for (TileWay *w = t->m_ways; w && !mustCancel; w = static_cast<TileWay *>(w->m_next))
+				EvaluateDrawRule(t);
+
+				for (unsigned i = 0; i < t->m_numWays && !mustCancel; i++)
 				{
-					for (OsmRelationList *rl = w->m_way->m_relations; rl; rl = static_cast<OsmRelationList *>(rl->m_next))
+					PrefetchTileWay(t, i + TILEPREFETCHDISTANCE);
+					OsmWay *way = GetTileWay(t, i);
+
+					unsigned numRelations = m_data->GetNumRelationsContainingWay(way);
+					for (unsigned r = 0; r < numRelations; r++)
 					{
-						if (!(job->m_renderedRelationIds.Has(rl->m_relation->m_id)))
+						OsmRelation *rel = m_data->GetRelationContainingWay(way, r);
+						if (!m_renderedRelations.Has(rel->m_index, job->m_generation))
 						{
-							RenderRelation(job, rl->m_relation);
+							RenderRelation(job, rel);
 						}
 					}
-					if (!(job->m_renderedWayIds.Has(w->m_way->m_id)))
+					if (!m_renderedWays.Has(way->m_index, job->m_generation))
 					{
-						RenderWay(job, w->m_way);
+						RenderWay(job, way);
 					}
 				}	// for way
 			}  // if overlaps
@@ -159,10 +654,10 @@ bool TileDrawer::RenderTiles(RenderJob *job, int maxNumToRender)
 	return job->m_finished;
 }
 
-void TileDrawer::Rect(Renderer *renderer, wxString const &text, double lon1, double lat1, double lon2, double lat2, double border, int r, int g, int b, int a, int layer)
+void TileDrawer::Rect(Renderer *renderer, wxString const &text, double x1, double y1, double x2, double y2, double border, int r, int g, int b, int a, int layer)
 {
-	renderer->Rect(lon1, lat1, lon2 - lon1, lat2 - lat1, border, r, g, b, a, false, layer);
-	renderer->DrawCenteredText(text.mb_str(wxConvUTF8), (lon1 + lon2)/2, (lat1 + lat2)/2, 0, r, g, b, a,  layer);
+	renderer->Rect(x1, y1, x2 - x1, y2 - y1, border, r, g, b, a, false, layer);
+	renderer->DrawCenteredText(text.mb_str(wxConvUTF8), (x1 + x2)/2, (y1 + y2)/2, 0, r, g, b, a,  layer);
 }
 
 
@@ -175,7 +670,7 @@ void TileDrawer::RenderRelation(Renderer *rnd, OsmRelation *r, wxColour lineColo
 			if (r->m_resolvedWays[i])
 			{
 				RenderWay(rnd, r->m_resolvedWays[i], lineColour, poly, fillColour, width, layer);
-//					job->m_renderedWayIds.Add(r->m_resolvedWays[i]->m_id); // if it has been drawn in the relation, don't draw it again on it's own
+//					m_renderedWays.Add(r->m_resolvedWays[i]->m_index, job->m_generation); // if it has been drawn in the relation, don't draw it again on it's own
 			}
 		}
 	}
@@ -188,7 +683,7 @@ void TileDrawer::RenderRelation(Renderer *rnd, OsmRelation *r, wxColour lineColo
 			if (w)
 			{
 				a.AddWay(w, r->m_roles[i] == IdObjectWithRole::INNER);
-//					job->m_renderedWayIds.Add(w->m_id); // if it has been drawn in the relation, don't draw it again on it's own
+//					m_renderedWays.Add(w->m_index, job->m_generation); // if it has been drawn in the relation, don't draw it again on it's own
 			}
 		}
 		rnd->SetLineColor(lineColour.Red(), lineColour.Green(), lineColour.Blue());
@@ -199,71 +694,38 @@ void TileDrawer::RenderRelation(Renderer *rnd, OsmRelation *r, wxColour lineColo
 
 void TileDrawer::RenderRelation(RenderJob *job, OsmRelation *r)
 {
-
-	if (m_drawRule && (m_drawRule->Evaluate(r) == LogicalExpression::S_FALSE))
+	RuleStyle style;
+	if (!GetStyle(r, &style))
 	{
 		return;
 	}
 
-	wxColour c = wxColour(150,150,150);
-	bool poly = false;
-	int layer = 1;
-	if (m_colorRules)
+	if (job->m_curLayer < 0 || job->m_curLayer == style.m_layer)
 	{
-		for (int i = 0; i < m_colorRules->m_num; i++)
-		{
-			if (m_colorRules->m_rules[i]->Evaluate(r) == LogicalExpression::S_TRUE)
-			{
-				c = m_colorRules->m_pickers[i]->GetColour();
-				poly = m_colorRules->m_checkBoxes[i]->IsChecked();
-				layer = m_colorRules->m_layers[i]->GetSelection();
-				break; // stop after first match
-			}
-		}
+		RenderRelation(job->m_renderer, r, style.m_colour, style.m_polygon, style.m_colour, 1, job->m_curLayer <0 ? style.m_layer : 0);
 	}
-
-	if (job->m_curLayer < 0 || job->m_curLayer == layer)
-	{
-		RenderRelation(job->m_renderer, r, c, poly, c, 1, job->m_curLayer <0 ? layer : 0);
-	}
-	job->m_renderedRelationIds.Add(r->m_id);
+	m_renderedRelations.Add(r->m_index, job->m_generation);
 
 }
 
 // render using default colours. should plug in rule engine here
 void TileDrawer::RenderWay(RenderJob *job, OsmWay *w)
 {
-	bool draw = true;
-
-	if (m_drawRule && (m_drawRule->Evaluate(w) == LogicalExpression::S_FALSE))
+	if (!job->m_renderer->IsVisible(w) || job->m_renderer->IsOutsideView(w))
 	{
-		draw = false;
+		return;
 	}
 
-	if (draw)
+	RuleStyle style;
+	if (!GetStyle(w, &style))
 	{
-		wxColour c = wxColour(150,150,150);
-		bool poly = false;
-		int layer = 1;
-		if (m_colorRules)
-		{
-			for (int i = 0; i < m_colorRules->m_num; i++)
-			{
-				if (m_colorRules->m_rules[i]->Evaluate(w) == LogicalExpression::S_TRUE)
-				{
-					c = m_colorRules->m_pickers[i]->GetColour();
-					poly = m_colorRules->m_checkBoxes[i]->IsChecked();
-					layer = m_colorRules->m_layers[i]->GetSelection();
-					break; // stop after first match
-				}
-			}
-		}
+		return;
+	}
 
-		if (job->m_curLayer < 0 || job->m_curLayer == layer)
-		{
-			RenderWay(job->m_renderer, w, c, poly, c, 1, job->m_curLayer <0 ? layer : 0);
-			job->m_renderedWayIds.Add(w->m_id);
-		}
+	if (job->m_curLayer < 0 || job->m_curLayer == style.m_layer)
+	{
+		RenderWay(job->m_renderer, w, style.m_colour, style.m_polygon, style.m_colour, 1, job->m_curLayer <0 ? style.m_layer : 0);
+		m_renderedWays.Add(w->m_index, job->m_generation);
 	}
 }
 
@@ -276,16 +738,19 @@ void TileDrawer::RenderWay(Renderer *r, OsmWay *w, wxColour lineColour, bool pol
 	r->SetLineColor(lineColour.Red(), lineColour.Green(), lineColour.Blue());
 	r->SetFillColor(fillColour.Red(), fillColour.Green(), fillColour.Blue());
 
+	unsigned numVertices = 0;
+	unsigned const *vertices = r->GetWayVertices(w, &numVertices);
+
 	if (!poly)
 	{
 		r->Begin(Renderer::R_LINE, layer);
-		for (unsigned j = 0; j < w->m_numResolvedNodes; j++)
+		for (unsigned j = 0; j < numVertices; j++)
 		{
-			OsmNode *node = w->m_resolvedNodes[j];
+			OsmNode *node = w->m_resolvedNodes[vertices ? vertices[j] : j];
 		
 			if (node)
 			{
-				r->AddPoint(node->Lon(), node->Lat());
+				r->AddPoint(node->X(), node->Y());
 			}
 			else
 			{
@@ -299,13 +764,13 @@ void TileDrawer::RenderWay(Renderer *r, OsmWay *w, wxColour lineColour, bool pol
 	else
 	{
 		r->Begin(Renderer::R_POLYGON, layer);
-		for (unsigned j = 0; j < w->m_numResolvedNodes; j++)
+		for (unsigned j = 0; j < numVertices; j++)
 		{
-			OsmNode *node = w->m_resolvedNodes[j];
+			OsmNode *node = w->m_resolvedNodes[vertices ? vertices[j] : j];
 		
 			if (node)
 			{
-				r->AddPoint(node->Lon(), node->Lat());
+				r->AddPoint(node->X(), node->Y());
 			}
 			
 		}
@@ -327,44 +792,53 @@ TileSpans *TileDrawer::GetTileSpans(TileList *all)
 	
 }
 
-void TileDrawer::LonLatToIndex(double lon, double lat, int *x, int *y)
+OsmTile *TileDrawer::GetTile(double x, double y)
 {
-	if (x)
-	{
-		*x = static_cast<int>(floor((lon - m_minLon) / m_dLon));
-		if (*x < 0) *x = 0;
-		if (*x > static_cast<int>(m_xNum - 1)) *x = static_cast<int>(m_xNum - 1);
-	}
+	TileTreeNode *node = m_root;
 
-	if (y)
+	while (!node->IsLeaf())
 	{
-		*y = static_cast<int>(floor((lat - m_minLat) / m_dLat));
-	if (*y < 0) *y = 0;
-	if (*y > static_cast<int>(m_yNum - 1)) *y = static_cast<int>(m_yNum - 1);
+		int q = 0;
+		if (x >= node->m_x + node->m_w / 2)
+		{
+			q |= 1;
+		}
+		if (y >= node->m_y + node->m_h / 2)
+		{
+			q |= 2;
+		}
+		node = node->m_children[q];
 	}
-}
 
+	return node->m_tile;
+}
 
-TileList *TileDrawer::GetTiles(double minLon, double minLat, double maxLon, double maxLat)
+void TileDrawer::CollectTiles(TileTreeNode *node, DRect const &box, TileList **list)
 {
-//            printf("gettiles (%g %g)-(%g-%g):\n", minLon, minLat, maxLon, maxLat);
-	int xMin = 0, xMax = 0, yMin = 0, yMax = 0;
-
-	LonLatToIndex(minLon, minLat, &xMin, &yMin);
-	LonLatToIndex(maxLon, maxLat, &xMax, &yMax);
-
-
-	TileList *ret = NULL;
+	if (!node->Touches(box))
+	{
+		return;
+	}
 
+	if (node->IsLeaf())
+	{
+		*list = new TileList(node->m_tile, *list);
+		return;
+	}
 
-	for (int x = xMin; x <= xMax; x++)
+	// reverse order, so the list comes out in tile id order
+	for (int q = 3; q >= 0; q--)
 	{
-		for (int y = yMin; y <= yMax; y++)
-		{
-			ret = new TileList(m_tileArray[x][y], ret);
-		}
+		CollectTiles(node->m_children[q], box, list);
 	}
+}
 
+TileList *TileDrawer::GetTiles(double minX, double minY, double maxX, double maxY)
+{
+//            printf("gettiles (%g %g)-(%g-%g):\n", minX, minY, maxX, maxY);
+	TileList *ret = NULL;
+
+	CollectTiles(m_root, DRect(minX, minY, maxX - minX, maxY - minY), &ret);
 	
 	if (ret)
 	{
@@ -372,58 +846,64 @@ TileList *TileDrawer::GetTiles(double minLon, double minLat, double maxLon, doub
 	}
 	
 	return ret;
-
-	
 }
 
-OsmNode *TileDrawer::GetClosestNodeInTile(int x, int y, double lon, double lat, double *foundDistSq)
+// only finds nodes of the ways that are drawn: the baked styles or the results of the draw rule of
+// the snapshot tell, and the draw rule is only evaluated for ways neither knows yet
+class DrawRuleFilter
+	: public NodeIndexFilter
 {
-	double fDSq = 0;
-	double shortest = -1;
-	OsmNode *found = NULL;
-	OsmNode *n;
-
-	for (TileWay *t = m_tileArray[x][y]->m_ways; t; t = static_cast<TileWay *>(t->m_next))
-	{
-		OsmWay * w = t->m_way;
-		if (!m_drawRule || m_drawRule->Evaluate(w))
+	public:
+		DrawRuleFilter(TileDrawer *drawer, Rule *rule)
 		{
-			n = w->GetClosestNode(lon,lat, &fDSq);
+			m_drawer = drawer;
+			m_rule = rule;
+			m_baked = !LogicalExpression::s_profiling && drawer->m_bakedStyles.IsFor(drawer->m_snapshot);
+			m_results = drawer->m_ruleCache.Get(rule->MD5());
+		}
 
-			if (shortest < 0.0 || fDSq < shortest)
+		bool Accept(OsmWay *way)
+		{
+			if (m_baked)
 			{
-//				printf(" found %p distsq %f\n", n, fDSq);
-				shortest = fDSq;
-				found = n;
+				return m_drawer->m_bakedStyles.Get(way) != BAKEDSTYLEHIDDEN;
 			}
-		}
-	}
 
-	if (foundDistSq)
-	{
-		*foundDistSq = shortest;
-	}
+			LogicalExpression::STATE s;
+			if (!m_results->Get(way, &s))
+			{
+				// a hit test isn't drawing, it stays out of the profile
+				s = m_rule->Evaluate(way, false);
+				m_results->Set(way, s);
+			}
 
-	return found;
-}
+			return s != LogicalExpression::S_FALSE;
+		}
 
+	private:
+		TileDrawer *m_drawer;
+		Rule *m_rule;
+		RuleResults *m_results;
+		bool m_baked;
+};
 
-OsmNode *TileDrawer::GetClosestNode(double lon, double lat)
+OsmNode *TileDrawer::GetClosestNode(double x, double y, double maxDist)
 {
-	int x =0, y = 0;
-	double distSq = -1;
-
-	LonLatToIndex(lon, lat, &x, &y);
-
-	OsmNode *found = GetClosestNodeInTile(x, y, lon, lat, &distSq);
+	// the nodes that are drawn now
+	Rule *drawRule = m_snapshot ? m_snapshot->GetDrawRule() : NULL;
+	if (!drawRule)
+	{
+		return m_nodeIndex.GetClosestNode(x, y, maxDist, NULL);
+	}
 
-	return found;
+	DrawRuleFilter filter(this, drawRule);
+	return m_nodeIndex.GetClosestNode(x, y, maxDist, &filter);
 }
 
 
-bool TileDrawer::SetSelection(double lon, double lat)
+bool TileDrawer::SetSelection(double x, double y, double maxDist)
 {
-	OsmNode *s = GetClosestNode(lon, lat);
+	OsmNode *s = GetClosestNode(x, y, maxDist);
 
 //	printf("setsel %f %f : %p (%f %f)\n", lon, lat, s, s->m_lon, s->m_lat);
 
@@ -469,9 +949,9 @@ void TileDrawer::DrawOverlay(Renderer *r, bool clear)
 		
 	if (m_selection)
 	{
-		double lon = m_selection->Lon();
-		double lat = m_selection->Lat();
-		r->Rect(lon, lat, 0, 0, 4, m_selectionColor.Red(), m_selectionColor.Green(), m_selectionColor.Blue(), 100, true, NUMLAYERS);
+		double x = m_selection->X();
+		double y = m_selection->Y();
+		r->Rect(x, y, 0, 0, 4, m_selectionColor.Red(), m_selectionColor.Green(), m_selectionColor.Blue(), 100, true, NUMLAYERS);
 	}
 
 	if (m_selectedWay)
@@ -486,26 +966,15 @@ void TileDrawer::DrawOverlay(Renderer *r, bool clear)
 
 	if (m_selectedTile)
 	{
-		for (TileWay *w = m_selectedTile->m_ways; w; w = (TileWay *)(w->m_next))
+		for (unsigned i = 0; i < m_selectedTile->m_numWays; i++)
 		{
-			RenderWay(r, w->m_way, m_selectionColor, false, wxColour(0,0,0), 3, NUMLAYERS);
+			RenderWay(r, GetTileWay(m_selectedTile, i), m_selectionColor, false, wxColour(0,0,0), 3, NUMLAYERS);
 
 		}
 		Rect(r, wxEmptyString, *m_selectedTile, -1, 255,55,55, 10, NUMLAYERS);
 	}
 }
 
-//destroy the list when done. the TileSpans member will not be set
-TileWay *TileDrawer::GetWaysContainingNode(OsmNode *node)
-{
-
-	int x = 0, y = 0;
-	LonLatToIndex(node->Lon(), node->Lat(), &x, &y);
-	
-
-	return m_tileArray[x][y]->GetWaysContainingNode(node);
-}
-
 bool TileDrawer::SetSelectionColor(int r, int g, int b)
 {
 	wxColour newColor(r, g, b);
@@ -521,3 +990,40 @@ bool TileDrawer::SetSelectionColor(int r, int g, int b)
 
 	return false;
 }
+
+unsigned TileDrawer::CountSkippedTiles(RuleSet const *rules, unsigned *numTiles) const
+{
+	unsigned ret = 0;
+	*numTiles = 0;
+
+	for (unsigned t = 0; t < m_tiles.GetCount(); t++)
+	{
+		if (!m_tiles[t]->m_numWays)
+		{
+			continue;
+		}
+
+		(*numTiles)++;
+		if (!rules->CanDraw(m_tiles[t]->m_tagSummary))
+		{
+			ret++;
+		}
+	}
+
+	return ret;
+}
+
+void TileDrawer::ReportMemory(MemoryReport *report)
+{
+	report->Add(wxT("tiles"), m_tiles.GetCount(), m_tiles.GetCount() * (sizeof(OsmTile) + sizeof(OsmTile *)));
+	report->Add(wxT("tile tree"), m_numTreeNodes, m_numTreeNodes * sizeof(TileTreeNode));
+	report->Add(wxT("tile way index"), m_tileWays.GetNumValues(), m_tileWays.GetMemoryUsage());
+	report->Add(wxT("way render stamps"), m_renderedWays.GetNum(), m_renderedWays.GetMemoryUsage());
+	report->Add(wxT("relation render stamps"), m_renderedRelations.GetNum(), m_renderedRelations.GetMemoryUsage());
+
+	m_pyramid.ReportMemory(report);
+	m_nodeIndex.ReportMemory(report);
+	m_ruleCache.ReportMemory(report);
+	m_styles.ReportMemory(report);
+	m_bakedStyles.ReportMemory(report);
+}
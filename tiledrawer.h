@@ -7,6 +7,13 @@
 #include "osm.h"
 #include "renderer.h"
 #include "s_expr.h"
+#include "geometrypyramid.h"
+#include "nodeindex.h"
+#include "tagsummary.h"
+#include "rulecache.h"
+#include "ruleclassifier.h"
+#include "ruleset.h"
+#include "bakedstyles.h"
 #include <wx/app.h>
 
 class TileList;
@@ -15,51 +22,77 @@ class ColorRules;
 class TileSpans;
 
 
-class TileWay
-	: public ListObject
+// how many ways ahead to prefetch when walking the ways of a tile
+#define TILEPREFETCHDISTANCE 4
+
+class OsmTile
+	: public IdObject, public DRect
 {
 	public:
-		TileWay(OsmWay *way,  TileWay *next);
+		OsmTile(unsigned id, double minX, double minY, double maxX, double maxY)
+			: IdObject(id), DRect(minX, minY, maxX - minX, maxY - minY)
+		{
+			m_ways = NULL;
+			m_numWays = 0;
+//            printf("created tile %u %g,%g  %g-%g\n", id, minX, minY, maxX, maxY);
+		}
 
-		~TileWay();
+		// indices of the ways in this tile, in ascending order. points into the TileDrawer's index,
+		// which is frozen after AddWays()
+		unsigned const *m_ways;
+		unsigned m_numWays;
 
-		OsmWay *m_way; // the way to render
+		// the tags of the ways, and of the relations they are in
+		TagSummary m_tagSummary;
 };
 
-class OsmTile
-	: public IdObject, public DRect
+WX_DEFINE_ARRAY(OsmTile *, OsmTileArray);
+
+// node of the adaptive quadtree the tiles live in. a node is either a leaf, pointing to its tile, or
+// has four children, one per quadrant. the tiles are owned by the TileDrawer, not by the tree
+class TileTreeNode
+	: public DRect
 {
 	public:
-		OsmTile(unsigned id, double minLon, double minLat, double maxLon, double maxLat)
-			: IdObject(id), DRect(minLon, minLat, maxLon - minLon, maxLat - minLat)
+		TileTreeNode(double minX, double minY, double maxX, double maxY)
+			: DRect(minX, minY, maxX - minX, maxY - minY)
 		{
-			m_ways = NULL;
-//            printf("created tile %u %g,%g  %g-%g\n", id, minLon, minLat, maxLon, maxLat);
+			m_tile = NULL;
+			for (int i = 0; i < 4; i++)
+			{
+				m_children[i] = NULL;
+			}
 		}
 
-		~OsmTile()
+		~TileTreeNode()
 		{
-			if (m_ways)
+			for (int i = 0; i < 4; i++)
 			{
-				m_ways->DestroyList();
+				delete m_children[i];
 			}
 		}
 
+		bool IsLeaf() const
+		{
+			return m_tile != NULL;
+		}
 
-		TileWay *GetWaysContainingNode(OsmNode *node);
-
-		void AddWay(OsmWay *way)
+		// closed interval test, so zero sized boxes (single node ways) still overlap
+		bool Touches(DRect const &box) const
 		{
-//            printf("tile %u add way %u\n", m_id, way->m_id);
-			m_ways = new TileWay(way, m_ways);
+			return !(box.m_x > Right() || box.Right() < m_x || box.m_y > Top() || box.Top() < m_y);
 		}
 
-		TileWay *m_ways;
+		bool IsInside(DRect const &box) const
+		{
+			return box.m_x <= m_x && box.Right() >= Right() && box.m_y <= m_y && box.Top() >= Top();
+		}
 
+		// children are ordered by quadrant: bit 0 set is the right half, bit 1 set is the top half
+		TileTreeNode *m_children[4];
+		OsmTile *m_tile;
 };
 
-WX_DEFINE_ARRAY(OsmTile *, OsmTileArray);
-
 
 class Span
 	: public ListObject
@@ -242,20 +275,86 @@ class TileList
 
 class OsmCanvas;
 
+// remembers per object the generation of the render job that last drew it. every job gets a new
+// generation, so starting a job needs no clearing, and checking whether an object was already drawn
+// in this job is a single compare
+class GenerationStamps
+{
+	public:
+		GenerationStamps()
+		{
+			m_stamps = NULL;
+			m_num = 0;
+		}
+
+		~GenerationStamps()
+		{
+			delete [] m_stamps;
+		}
+
+		void Init(unsigned num)
+		{
+			delete [] m_stamps;
+			m_num = num;
+			m_stamps = new unsigned[m_num ? m_num : 1];
+			Clear();
+		}
+
+		// generation 0 is never handed out, so after this nothing counts as drawn
+		void Clear()
+		{
+			memset(m_stamps, 0, sizeof(unsigned) * (m_num ? m_num : 1));
+		}
+
+		bool Has(unsigned index, unsigned generation) const
+		{
+			assert(index < m_num);
+			return m_stamps[index] == generation;
+		}
+
+		void Add(unsigned index, unsigned generation)
+		{
+			assert(index < m_num);
+			m_stamps[index] = generation;
+		}
+
+		unsigned GetNum() const
+		{
+			return m_num;
+		}
+
+		size_t GetMemoryUsage() const
+		{
+			return sizeof(unsigned) * m_num;
+		}
+
+	private:
+		unsigned *m_stamps;
+		unsigned m_num;
+};
+
 class RenderJob
 {
 	public:
-		RenderJob(Renderer *renderer)
+		// draws with rules, see TileDrawer::SnapshotRules()
+		RenderJob(Renderer *renderer, RuleSet *rules)
 		{
 			m_bb = renderer->GetViewport();
+			m_rules = rules;
+			m_rules->Ref();
 			m_curLayer = renderer->SupportsLayers() ? -1 : 0;
 			m_visibleTiles = m_curTile = NULL;
 			m_numTilesToRender = m_numTilesRendered = 0;
 			m_finished = false;
 			m_renderer = renderer;
+			m_generation = 0;
+			m_profiling = LogicalExpression::s_profiling;
 		}
 		
-		virtual ~RenderJob() { }
+		virtual ~RenderJob()
+		{
+			m_rules->UnRef();
+		}
 
 		// reports progress. returns true when the rendering should be aborted
 		virtual bool MustCancel(double progress) = 0;
@@ -268,61 +367,60 @@ class RenderJob
 		int m_numTilesToRender, m_numTilesRendered;
 		int m_curLayer;
 		DRect m_bb;
+		RuleSet *m_rules;
 		bool m_finished;
 //		TileSpans m_renderedTiles;
-		IdSet m_renderedWayIds;
-		IdSet m_renderedRelationIds;
+		unsigned m_generation; // stamp for the ways and relations this job has drawn
 		Renderer *m_renderer;
+		bool m_profiling; // as it was set when the job was made
 
 };
 
 class TileDrawer
 {
 	public:
-		TileDrawer(double minLon,double minLat, double maxLon, double maxLat, double dLon, double dLat);
+		// all coordinates are projected, see ProjectLon() and ProjectLat(). the tiles form an adaptive
+		// quadtree over the bounding box, built by AddWays(). a tile is split until no more than
+		// maxWaysPerTile ways touch it, or it reaches maxDepth
+		TileDrawer(OsmData *data, double minX, double minY, double maxX, double maxY, unsigned maxWaysPerTile = 1024, unsigned maxDepth = 16);
 
 		~TileDrawer()
 		{
 			WX_CLEAR_ARRAY(m_tiles);
 			m_tiles.Clear();
-			for (unsigned x = 0; x < m_xNum; x++)
+			delete m_root;
+			delete [] m_colorStates;
+			delete [] m_batch;
+
+			if (m_snapshot)
 			{
-				delete [] m_tileArray[x];
+				m_snapshot->UnRef();
 			}
-			delete [] m_tileArray;
-		}
 
-		void AddWays(IdObjectArrayLarge *ways)
-		{
-			for (unsigned w  = 0; w < ways->GetCount(); w++)
+			if (m_classifierRules)
 			{
-				OsmWay  *way = dynamic_cast<OsmWay *>(ways->Get(w));
-				wxASSERT(way);
-				AddWay(way);
-				if (!(w % 10000))
-				{
-					printf("sorted %uK ways\n", w / 1000);
-				}
+				m_classifierRules->UnRef();
 			}
 		}
 
-		void AddWay(OsmWay *way)
+		// builds the tree from the bounding boxes of the ways and adds every way to the tiles it
+		// intersects. also builds the geometry pyramid for the ways. call only once, on an empty
+		// TileDrawer. ways are the resolved ways of the data, see OsmData::Resolve(). the array must stay
+		// alive, the tiles refer to the ways by their index in it
+		void AddWays(IdObjectArrayLarge *ways);
+
+		// way i of a tile
+		OsmWay *GetTileWay(OsmTile const *tile, unsigned i) const
 		{
-			DRect bb = way->GetBB();
+			return static_cast<OsmWay *>(m_ways->Get(tile->m_ways[i]));
+		}
 
-			TileList *tiles = GetTiles(bb);
-			assert(tiles);
-			
-			for (TileList *l = tiles; l; l = static_cast<TileList *>(l->m_next))
+		void PrefetchTileWay(OsmTile const *tile, unsigned i) const
+		{
+			if (i < tile->m_numWays)
 			{
-				if (way->Intersects(*(l->m_tile)))
-				{
-					l->m_tile->AddWay(way);
-				}
+				__builtin_prefetch(m_ways->Get(tile->m_ways[i]));
 			}
-
-
-			tiles->UnRef();
 		}
 
 		TileSpans *GetTileSpans(TileList *tiles);
@@ -333,24 +431,29 @@ class TileDrawer
 		}
 
 		// you should UnRef the list when done, which will destroy it if not used anymore
-		TileList *GetTiles(double minLon, double minLat, double maxLon, double maxLat);
+		// returns NULL if no tile overlaps the box
+		TileList *GetTiles(double minX, double minY, double maxX, double maxY);
 
 		// numToRender  - render this many tiles and then return (so you can do progress displays etc)
 		// returns true when the job is finished
 		bool RenderTiles(RenderJob *job,int numToRender);
 
-		OsmNode *GetClosestNodeInTile(int x, int y, double lon, double lat, double *foundDistSq);
+		// the closest node of a drawn way within maxDist of (x, y), across tile borders. maxDist < 0
+		// means any distance. NULL if there is none
+		OsmNode *GetClosestNode(double x, double y, double maxDist = -1);
 
-		OsmNode *GetClosestNode(double lon, double lat);
-
-		//destroy the list when done. the TileSpans member will not be set
-		TileWay *GetWaysContainingNode(OsmNode *node);
+		void GetWaysContainingNode(OsmNode *node, WayPointerArray *ways)
+		{
+			m_data->GetWaysContainingNode(node, ways);
+		}
 		
+		// selects the closest node within maxDist, or nothing if there is none
 		// returns true if the selection has changed and you should refresh the canvas
-		bool SetSelection(double lon, double lat);
+		bool SetSelection(double x, double y, double maxDist = -1);
 
 		void DrawOverlay(Renderer *r, bool clear = false);
 
+		// the controls that SnapshotRules() copies the rules from
 		void SetDrawRuleControl(RuleControl *r)
 		{
 			m_drawRule = r;
@@ -361,6 +464,31 @@ class TileDrawer
 			m_colorRules = r;
 		}
 
+		// the rules of the controls, for a job that draws with renderer. the same RuleSet as last time
+		// if the controls and the scale didn't change. only on the gui thread
+		RuleSet *SnapshotRules(Renderer *renderer);
+
+		// a new RuleSet of the controls, for a one off job that draws with renderer, such as a pdf.
+		// the snapshot of the canvas and its baked styles are left alone. only on the gui thread
+		RuleSet *CreateRules(Renderer *renderer);
+
+		// the RuleSet SnapshotRules() made last, NULL if there is none yet
+		RuleSet *GetRuleSet()
+		{
+			return m_snapshot;
+		}
+
+		// the baked styles of RuleSets are kept next to the data cache in cacheFile, see BakedStyles.
+		// SnapshotRules() loads them for a new RuleSet if they are there
+		void SetCacheFile(wxString const &cacheFile)
+		{
+			m_cacheFile = cacheFile;
+		}
+
+		// evaluates rules for all objects, draws with the result from now on, and saves it next to
+		// the cache. false if it couldn't be saved
+		bool BakeStyles(RuleSet *rules);
+
 		// with explicit colours
 		void RenderWay(Renderer *r, OsmWay *w, wxColour lineColour, bool polygon, wxColour fillColour, int width, int layer);
 		void RenderRelation(Renderer *rnd, OsmRelation *r, wxColour lineColour, bool polygon, wxColour fillColour, int width, int layer);
@@ -373,16 +501,15 @@ class TileDrawer
 			Rect(renderer, text, re.m_x, re.m_y, re.m_x + re.m_w, re.m_y + re.m_h, border, r, g, b, a, layer);
 		}
 		
-		void Rect(Renderer *renderer, wxString const &text, double lon1, double lat1, double lon2, double lat2, double border, int r, int g, int b,int a, int layer);
+		void Rect(Renderer *renderer, wxString const &text, double x1, double y1, double x2, double y2, double border, int r, int g, int b,int a, int layer);
 
-		TileWay *GetSelection()
+		// fills ways with all ways containing the selected node
+		void GetSelection(WayPointerArray *ways)
 		{
-			if (!m_selection)
+			if (m_selection)
 			{
-				return NULL;
+				GetWaysContainingNode(m_selection, ways);
 			}
-
-			return GetWaysContainingNode(m_selection);
 		}
 
 		bool SetSelectedWay(OsmWay *way);
@@ -390,17 +517,105 @@ class TileDrawer
 
 		bool SetSelectionColor(int r, int g, int b);
 
-	private:
+		void ReportMemory(MemoryReport *report);
+
+		// how many of the tiles with ways rules skips by their tag summary, see RuleSet::CanDraw(). the
+		// number of tiles with ways is stored in numTiles
+		unsigned CountSkippedTiles(RuleSet const *rules, unsigned *numTiles) const;
+
+		// only valid after AddWays()
+		GeometryPyramid const *GetPyramid() const
+		{
+			return &m_pyramid;
+		}
 
-		void LonLatToIndex(double lon, double lat, int *x, int *y);
+	private:
 
+		// returns the tile containing the point. points outside the tree are clamped to its border
+		OsmTile *GetTile(double x, double y);
+
+		// splits node until its leaves hold few enough candidates, and creates the tiles for the leaves.
+		// doesn't assign the ways to the tiles, that is done afterwards in parallel by BinWay()
+		void BuildTree(TileTreeNode *node, DRect const *bbs, wxArrayInt &candidates, unsigned depth);
+		friend class BinWaysJob;
+		friend class DrawRuleFilter;
+		// appends a (tile id, index) pair to pairs for every leaf below node that way intersects.
+		// only reads the tree, so can be called from several threads at once
+		void BinWay(TileTreeNode const *node, OsmWay *way, unsigned index, DRect const &bb, wxArrayInt &pairs) const;
+		void CollectTiles(TileTreeNode *node, DRect const &box, TileList **list);
+
+		OsmData *m_data;
+		IdObjectArrayLarge *m_ways;
+		CSRIndex m_tileWays; // tile id -> indices into m_ways
 		OsmTileArray m_tiles;
-		OsmTile ***m_tileArray;
-		unsigned m_xNum, m_yNum;
-		double m_minLon, m_minLat, m_w, m_h, m_dLon, m_dLat;
+		TileTreeNode *m_root;
+		unsigned m_maxWaysPerTile;
+		unsigned m_maxDepth;
+		unsigned m_numTreeNodes;
+
+		// only one job at a time can use these: a job that runs while another one is unfinished
+		// invalidates what the other one has drawn. the other one must be restarted
+		GenerationStamps m_renderedWays;
+		GenerationStamps m_renderedRelations;
+		unsigned m_generation;
+		unsigned NextGeneration();
+
+		GeometryPyramid m_pyramid;
+		NodeIndex m_nodeIndex;
 
 		RuleControl *m_drawRule;
 		ColorRules *m_colorRules;
+		RuleSet *m_snapshot;
+
+		// the rules of the job that is being drawn, and whether it profiles them, only during
+		// RenderTiles()
+		RuleSet *m_rules;
+		bool m_profiling;
+
+		// what the rules gave for the objects drawn before. rules that didn't change since then reuse
+		// them, so panning, zooming or editing another rule doesn't evaluate them again
+		RuleCache m_ruleCache;
+		RuleResults *m_drawResults;
+		RuleResultsArray m_colorResults;
+
+		// the color rule of the objects drawn before, kept while the rules up to it don't change
+		StyleCache m_styles;
+
+		// the color rules compiled together, and room for the values it finds for them. the
+		// classifier refers to the rules of m_classifierRules, it is kept while it is in use
+		RuleClassifier m_colorClassifier;
+		RuleSet *m_classifierRules;
+		unsigned char *m_colorStates;
+
+		// looks up the results of the rules of m_rules, and rebuilds the classifier if the color
+		// rules changed. has to be called again for every other RuleSet
+		void FetchRuleResults();
+
+		// the scale the rules are evaluated at for a job that draws with renderer
+		static RuleScale GetRuleScale(Renderer *renderer);
+
+		// rule->Evaluate(o), from results when it is known and the job doesn't profile. results may be NULL
+		LogicalExpression::STATE Evaluate(Rule *rule, RuleResults *results, IdObjectWithTags *o);
+
+		// evaluates the draw rule for the ways of t that it isn't known for yet in one batch, and
+		// stores the values in m_drawResults
+		void EvaluateDrawRule(OsmTile const *t);
+		IdObjectWithTags const **m_batch;
+		unsigned m_maxBatch;
+		IndexBitset m_batchTrue, m_batchFalse;
+
+		// the index of the first color rule that is S_TRUE for o, -1 if there is none
+		int GetColorRule(IdObjectWithTags *o);
+
+		// the styles of one RuleSet for all objects, used instead of the rules while m_rules is that
+		// set and nothing is profiled
+		BakedStyles m_bakedStyles;
+		bool m_useBakedStyles;
+		wxString m_cacheFile;
+
+		// the style of the color rule of o, from the baked styles or the rules. false if the draw
+		// rule hides it
+		bool GetStyle(IdObjectWithTags *o, RuleStyle *style);
 
 		OsmNode *m_selection;
 		OsmWay *m_selectedWay;
@@ -0,0 +1,175 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#include "valuematcher.h"
+#include <wx/regex.h>
+#include <math.h>
+
+ValueMatcher *ValueMatcher::s_matchers = NULL;
+wxCriticalSection ValueMatcher::s_lock;
+
+ValueMatcher *ValueMatcher::Get(KIND kind, char const *key, double min, double max, char const *pattern)
+{
+	wxCriticalSectionLocker locker(s_lock);
+
+	for (ValueMatcher *m = s_matchers; m; m = m->m_next)
+	{
+		if (m->IsFor(kind, key, min, max, pattern))
+		{
+			m->m_refCount++;
+			return m;
+		}
+	}
+
+	ValueMatcher *m = new ValueMatcher(kind, key, min, max, pattern);
+	m->m_next = s_matchers;
+	s_matchers = m;
+
+	return m;
+}
+
+void ValueMatcher::Ref()
+{
+	wxCriticalSectionLocker locker(s_lock);
+
+	m_refCount++;
+}
+
+void ValueMatcher::UnRef()
+{
+	wxCriticalSectionLocker locker(s_lock);
+
+	assert(m_refCount);
+
+	if (--m_refCount)
+	{
+		return;
+	}
+
+	for (ValueMatcher **p = &s_matchers; *p; p = &((*p)->m_next))
+	{
+		if (*p == this)
+		{
+			*p = m_next;
+			break;
+		}
+	}
+
+	delete this;
+}
+
+bool ValueMatcher::IsFor(KIND kind, char const *key, double min, double max, char const *pattern) const
+{
+	if (kind != m_kind || min != m_min || max != m_max || strcmp(key, m_keyText) || strcmp(pattern ? pattern : "", m_pattern) || IsOutdated())
+	{
+		return false;
+	}
+
+	// a rule parsed before the data was loaded doesn't know the key yet
+	OsmTag tag(true, key);
+	return tag.Index().Equal(m_key);
+}
+
+ValueMatcher::ValueMatcher(KIND kind, char const *key, double min, double max, char const *pattern)
+{
+	m_kind = kind;
+	m_keyText = strdup(key);
+	m_min = min;
+	m_max = max;
+	m_pattern = strdup(pattern ? pattern : "");
+	m_patternLength = strlen(m_pattern);
+	m_regex = NULL;
+	m_ok = true;
+	m_table = NULL;
+	m_num = 0;
+	m_built = false;
+	m_refCount = 1;
+	m_next = NULL;
+
+	OsmTag tag(true, key);
+	m_key = tag.Index();
+
+	if (m_kind == REGEX)
+	{
+		m_regex = new wxRegEx(wxString::FromUTF8(m_pattern), wxRE_EXTENDED | wxRE_NOSUB);
+		m_ok = m_regex->IsValid();
+	}
+}
+
+ValueMatcher::~ValueMatcher()
+{
+	free(m_keyText);
+	free(m_pattern);
+	delete m_regex;
+	delete [] m_table;
+}
+
+bool ValueMatcher::Test(unsigned keyIndex, unsigned valueNumber, double const *numbers) const
+{
+	double n = numbers ? numbers[valueNumber] : NAN;
+
+	// comparisons with NaN are false, so values that aren't numbers never match
+	switch(m_kind)
+	{
+		case LESS:
+			return n < m_min;
+		case LESSEQUAL:
+			return n <= m_min;
+		case GREATER:
+			return n > m_min;
+		case GREATEREQUAL:
+			return n >= m_min;
+		case RANGE:
+			return n >= m_min && n <= m_max;
+		case PREFIX:
+			return !strncmp(OsmTag::m_tagStore->GetValue(keyIndex, valueNumber), m_pattern, m_patternLength);
+		case REGEX:
+			return m_ok && m_regex->Matches(wxString::FromUTF8(OsmTag::m_tagStore->GetValue(keyIndex, valueNumber)));
+	}
+
+	return false;
+}
+
+bool ValueMatcher::IsOutdated() const
+{
+	TagIndex key = m_key;
+
+	return m_built && key.Valid() && OsmTag::m_tagStore->GetNumValues(key.m_keyIndex) != m_num;
+}
+
+ValueMatcher *ValueMatcher::Build()
+{
+	if (IsOutdated())
+	{
+		ValueMatcher *ret = Get(m_kind, m_keyText, m_min, m_max, m_pattern);
+		UnRef();
+		return ret->Build();
+	}
+
+	if (m_built)
+	{
+		return this;
+	}
+
+	m_built = true;
+
+	TagIndex key = m_key;
+	if (!key.Valid())
+	{
+		return this;
+	}
+
+	TagStore *store = OsmTag::m_tagStore;
+	m_num = store->GetNumValues(key.m_keyIndex);
+
+	bool numeric = m_kind != PREFIX && m_kind != REGEX;
+	double const *numbers = numeric ? store->GetNumbers(key.m_keyIndex) : NULL;
+
+	m_table = new unsigned char[m_num ? m_num : 1];
+	for (unsigned i = 0; i < m_num; i++)
+	{
+		m_table[i] = Test(key.m_keyIndex, i, numbers);
+	}
+
+	return this;
+}
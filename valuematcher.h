@@ -0,0 +1,125 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#ifndef __VALUEMATCHER_H__
+#define __VALUEMATCHER_H__
+
+#include "osm.h"
+#include <wx/thread.h>
+
+class wxRegEx;
+
+// tests the values of one key against a numeric comparison or a text pattern. the test is done once
+// per value in the TagStore, into a table, so matching an object's tag is a lookup. the table only
+// depends on the test, so all expressions with the same test share one matcher: Get() returns it with
+// a reference added, and the last UnRef() deletes it. Build() fills the table before the matcher is
+// used, and it doesn't change after that, so Matches() only reads and can be called on any thread
+class ValueMatcher
+{
+	public:
+		enum KIND
+		{
+			LESS,           // the value is a number below m_min
+			LESSEQUAL,
+			GREATER,        // the value is a number above m_min
+			GREATEREQUAL,
+			RANGE,          // the value is a number from m_min up to and including m_max
+			PREFIX,         // the value starts with the pattern
+			REGEX           // the value matches the pattern, a posix extended regular expression
+		};
+
+		// max is only used by RANGE, pattern only by PREFIX and REGEX. the table isn't built yet, only
+		// on the gui thread
+		static ValueMatcher *Get(KIND kind, char const *key, double min, double max, char const *pattern);
+
+		void Ref();
+		void UnRef();
+
+		// the matcher for this test with the table built: this one, or, if values were added to the
+		// TagStore after its table was built, a new one, as others may be reading that table. the
+		// reference moves to the one returned. only on the gui thread
+		ValueMatcher *Build();
+
+		// false if the pattern of a REGEX doesn't compile
+		bool IsOk() const
+		{
+			return m_ok;
+		}
+
+		// the key, without a value. invalid if the key isn't in the TagStore, no object has it then
+		TagIndex GetKey() const
+		{
+			return m_key;
+		}
+
+		KIND GetKind() const
+		{
+			return m_kind;
+		}
+
+		double GetMin() const
+		{
+			return m_min;
+		}
+
+		double GetMax() const
+		{
+			return m_max;
+		}
+
+		char const *GetPattern() const
+		{
+			return m_pattern;
+		}
+
+		// valueIndex as in TagIndex::m_valueIndex. a tag without a value doesn't match
+		bool Matches(unsigned valueIndex) const
+		{
+			assert(m_built);
+
+			return valueIndex && valueIndex <= m_num && m_table[valueIndex - 1];
+		}
+
+		// true if an object with tag index matches
+		bool Matches(TagIndex const &index) const
+		{
+			return index.m_keyIndex == m_key.m_keyIndex && Matches(index.m_valueIndex);
+		}
+
+	private:
+		ValueMatcher(KIND kind, char const *key, double min, double max, char const *pattern);
+		~ValueMatcher();
+		ValueMatcher(ValueMatcher const &other);
+		ValueMatcher const &operator=(ValueMatcher const &other);
+
+		// true if it does this test, for the key as it is in the TagStore now
+		bool IsFor(KIND kind, char const *key, double min, double max, char const *pattern) const;
+
+		// true if the table was built before values were added to the TagStore
+		bool IsOutdated() const;
+
+		bool Test(unsigned keyIndex, unsigned valueNumber, double const *numbers) const;
+
+		KIND m_kind;
+		char *m_keyText;
+		TagIndex m_key;
+		double m_min, m_max;
+		char *m_pattern;
+		size_t m_patternLength;
+		wxRegEx *m_regex;
+		bool m_ok;
+
+		unsigned char *m_table; // per value of the key, 1 if it matches
+		unsigned m_num;
+		bool m_built;
+
+		unsigned m_refCount;
+		ValueMatcher *m_next; // in s_matchers
+
+		// all matchers that have references. the lock is for UnRef(), the last reference to a rule can
+		// be dropped on another thread
+		static ValueMatcher *s_matchers;
+		static wxCriticalSection s_lock;
+};
+
+#endif
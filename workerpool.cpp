@@ -0,0 +1,100 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#include "workerpool.h"
+#include <wx/dynarray.h>
+
+class WorkerThread
+	: public wxThread
+{
+	public:
+		WorkerThread(WorkerPool *pool, unsigned index)
+			: wxThread(wxTHREAD_JOINABLE)
+		{
+			m_pool = pool;
+			m_index = index;
+		}
+
+	protected:
+		ExitCode Entry()
+		{
+			m_pool->Work(m_index);
+			return 0;
+		}
+
+	private:
+		WorkerPool *m_pool;
+		unsigned m_index;
+};
+
+WX_DEFINE_ARRAY_PTR(WorkerThread *, WorkerThreadArray);
+
+WorkerPool::WorkerPool(unsigned numThreads, unsigned blockSize)
+{
+	if (!numThreads)
+	{
+		int cpus = wxThread::GetCPUCount();
+		numThreads = cpus > 0 ? cpus : 1;
+	}
+
+	m_numThreads = numThreads;
+	m_blockSize = blockSize ? blockSize : 1;
+	m_job = NULL;
+	m_num = m_next = 0;
+}
+
+bool WorkerPool::NextBlock(unsigned *from, unsigned *to)
+{
+	// lock free: every thread atomically claims the next block
+	unsigned start = __sync_fetch_and_add(&m_next, m_blockSize);
+
+	if (start >= m_num)
+	{
+		return false;
+	}
+
+	*from = start;
+	*to = (m_num - start > m_blockSize) ? start + m_blockSize : m_num;
+	return true;
+}
+
+void WorkerPool::Work(unsigned thread)
+{
+	unsigned from, to;
+	while (NextBlock(&from, &to))
+	{
+		m_job->Run(thread, from, to);
+	}
+}
+
+void WorkerPool::Run(ParallelJob *job, unsigned num)
+{
+	m_job = job;
+	m_num = num;
+	m_next = 0;
+
+	WorkerThreadArray threads;
+
+	// the calling thread works as thread 0, so only start the others
+	for (unsigned i = 1; i < m_numThreads && num > m_blockSize * i; i++)
+	{
+		WorkerThread *t = new WorkerThread(this, i);
+		if (t->Create() != wxTHREAD_NO_ERROR || t->Run() != wxTHREAD_NO_ERROR)
+		{
+			// can't start it, the remaining threads will pick up its share
+			delete t;
+			break;
+		}
+		threads.Add(t);
+	}
+
+	Work(0);
+
+	for (unsigned i = 0; i < threads.GetCount(); i++)
+	{
+		threads[i]->Wait();
+		delete threads[i];
+	}
+
+	m_job = NULL;
+}
@@ -0,0 +1,50 @@
+// this file is part of osmbrowser
+// copyright Martijn Versteegh
+// osmbrowser is licenced under the gpl v3
+#ifndef __WORKERPOOL_H__
+#define __WORKERPOOL_H__
+
+#include <wx/thread.h>
+
+// a piece of work that can be split up over a range of indices
+class ParallelJob
+{
+	public:
+		virtual ~ParallelJob() { }
+
+		// process indices [from, to). thread is in [0, WorkerPool::GetNumThreads()) and can be used to
+		// address per thread buffers. Run() is called many times per thread, with consecutive blocks handed
+		// out on demand, so uneven work per index still spreads evenly
+		virtual void Run(unsigned thread, unsigned from, unsigned to) = 0;
+};
+
+class WorkerPool
+{
+	public:
+		// numThreads == 0 means one thread per cpu
+		WorkerPool(unsigned numThreads = 0, unsigned blockSize = 1024);
+
+		unsigned GetNumThreads() const
+		{
+			return m_numThreads;
+		}
+
+		// runs job over [0, num) and returns when all of it is done
+		void Run(ParallelJob *job, unsigned num);
+
+	private:
+		friend class WorkerThread;
+
+		// hands out the next block. returns false when there is no work left
+		bool NextBlock(unsigned *from, unsigned *to);
+		void Work(unsigned thread);
+
+		unsigned m_numThreads;
+		unsigned m_blockSize;
+
+		ParallelJob *m_job;
+		unsigned m_num;
+		unsigned m_next;
+};
+
+#endif
@@ -10,8 +10,18 @@
 class MyApp : public wxApp
 {
 public:
+	MyApp()
+	{
+		m_stats = false;
+	}
+
 	virtual bool OnInit();
 	void OnInitCmdLine(wxCmdLineParser& parser);
+	bool OnCmdLineParsed(wxCmdLineParser& parser);
+
+private:
+	wxString m_fileName;
+	bool m_stats;
 };
 
 
@@ -29,14 +39,14 @@ bool MyApp::OnInit()
 
 	wxConfig::Set(cfg);
 
-	if (argc !=2)
+	if (m_fileName.IsEmpty())
 	{
-		printf("usage: osmbrowser <osmfile>\n");
+		printf("usage: osmbrowser [--stats] <osmfile>\n");
 		return false;
 	}
 
 	// create the main application window
-	MainFrame *frame = new MainFrame(this, _T("Osm Browser"), argv[1]);
+	MainFrame *frame = new MainFrame(this, _T("Osm Browser"), m_fileName);
 
 	// and show it (the frames, unlike simple controls, are not shown when
 	// created initially)
@@ -44,6 +54,11 @@ bool MyApp::OnInit()
 
 	frame->m_canvas->Unlock(true);
 
+	if (m_stats)
+	{
+		frame->MemoryReportText();
+	}
+
 	// success: wxApp::OnRun() will be called which will enter the main message
 	// loop and the application will run. If we returned false here, the
 	// application would exit immediately.
@@ -54,6 +69,7 @@ static const wxCmdLineEntryDesc gCmdLineDesc[] =
 {
 	{ wxCMD_LINE_SWITCH, wxT("v"), wxT("verbose"), wxT("verbose logging"), wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL },
 	{ wxCMD_LINE_SWITCH, wxT("h"), wxT("help"), wxT("Display usage info"), wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP },
+	{ wxCMD_LINE_SWITCH, wxT("s"), wxT("stats"), wxT("print a memory report after loading"), wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL },
 	{ wxCMD_LINE_PARAM, NULL, NULL, wxT("File to open"), wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL},
 	{ wxCMD_LINE_NONE, NULL, NULL, NULL, wxCMD_LINE_VAL_NONE, 0},
 }; 
@@ -64,3 +80,19 @@ void MyApp::OnInitCmdLine(wxCmdLineParser& parser)
 		parser.SetSwitchChars(wxT("-"));
 }
 
+bool MyApp::OnCmdLineParsed(wxCmdLineParser& parser)
+{
+	if (!wxApp::OnCmdLineParsed(parser))
+	{
+		return false;
+	}
+
+	m_stats = parser.Found(wxT("s"));
+
+	if (parser.GetParamCount())
+	{
+		m_fileName = parser.GetParam(0);
+	}
+
+	return true;
+}